@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../include/includeT.h"
+
+#pragma once
+
+// MACROS
+#define SCHED_MAX_WORKERS 64
+#define SCHED_IDLE_MS 10
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+// TYPEDEFS
+// Steps of a TRENO hosted as an agent, see agentRun
+typedef enum agentState_t {
+    AGENT_START,     // itinerary not received yet
+    AGENT_NEXT,      // at route.nodes[step], about to travel to the end of it
+    AGENT_ADVANCE,   // travelled to the end of route.nodes[step], asking to move to the next node
+    AGENT_DONE       // destination reached
+} agentState_t;
+// TRENO hosted by the in-process scheduler, step is the index of its current position in route
+// and authEnd the index of the last node of its movement authority
+typedef struct agent_t {
+    int trainNum;
+    agentState_t state;
+    route_t route;
+    int step;
+    int authEnd;
+    bool parked;            // waiting on a segment, under the park lock of the scheduler
+    uint32_t parkSeq;       // numbers the parks, so that a timeout only ends the park it was set for
+} agent_t;
+
+void schedRun(const int nTrains, const int etcs);
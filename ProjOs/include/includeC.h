@@ -0,0 +1,28 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#pragma once
+
+// MACROS
+#define CLOCK_SHM_NAME "/rail_clock"
+#define RETRY_PAUSE_MS 1000
+#define VIRTUAL_RETRY_PAUSE_MS 10
+
+// TYPEDEFS
+// Virtual clock shared by the processes of a simulation run.
+// nowNs is the simulated time elapsed since the start of the run, epoch the wall-clock time of the start.
+typedef struct simClock_t {
+    atomic_uint_fast64_t nowNs;
+    time_t epoch;
+} simClock_t;
+
+void clockUseVirtual(const bool create);
+bool clockIsVirtual();
+uint64_t clockNowNs();
+void clockAdvanceTo(const uint64_t ns);
+time_t clockWallTime();
+int64_t clockWallOffsetNs();
+void clockRetryPause();
+void clockDestroy();
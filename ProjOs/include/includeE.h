@@ -0,0 +1,54 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#pragma once
+
+// MACROS
+#define EVLOG_MAGIC 0x474c5652          // "RVLG"
+#define EVLOG_VERSION 1
+#define EVLOG_INITIAL_CAPACITY 4096     // records, doubled when the file is full
+#define EVLOG_RBC "log/RBC.bin"
+#define EVLOG_TRAIN_FORMAT "log/T%d.bin"
+
+// TYPEDEFS
+// Types of the events of the binary log
+typedef enum evlogType_t {
+    EVLOG_POSITION = 1,     // a train moves, from the T<n> log
+    EVLOG_AUTH              // an authorization decided by the RBC
+} evlogType_t;
+// Event record, fixed size. committed is set last, records claimed by a process that died before
+// filling them are left at 0 and skipped by the decoder.
+typedef struct evlogRecord_t {
+    uint64_t timeNs;        // clockNowNs() of the producer, monotonic (simulated in virtual time runs)
+    uint8_t type;
+    uint8_t auth;
+    uint8_t reserved;
+    _Atomic uint8_t committed;
+    int32_t trainNum;
+    int32_t currNode;
+    int32_t nextNode;
+    uint32_t reserved2[2];
+} evlogRecord_t;
+// File header, followed by capacity records. count is the number of records claimed so far,
+// processes appending to the same file claim slots with an atomic increment.
+typedef struct evlogHeader_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    int64_t wallOffsetNs;   // added to timeNs gives the wall-clock time in ns since the epoch
+    _Atomic uint64_t count;
+    _Atomic uint64_t capacity;
+    uint64_t reserved[4];
+} evlogHeader_t;
+// Event log mapped by the current process
+typedef struct evlog_t {
+    int fd;
+    evlogHeader_t *header;
+    uint64_t capacity;      // records covered by the current mapping
+} evlog_t;
+
+evlog_t *evlogOpen(const char *path, const int64_t wallOffsetNs);
+void evlogAppend(evlog_t *log, const evlogRecord_t *record);
+void evlogClose(evlog_t *log);
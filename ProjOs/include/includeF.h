@@ -11,49 +11,118 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 // MACROS
+// Sizes of the built-in maps, topology files bring their own (see includeM.h)
 #define N_TRAINS 5
 #define N_STATIONS 8
 #define N_SEGM 16
 #define N_MAPS 2
 #define N_ETCS 2
+#define TRAVEL_TIME 2
 #define DEFAULT_PROTOCOL 0
 #define N_RBC_PIPE 0
 #define SERVER_NAME "/tmp/rbc_server"
 #define PIPE_FORMAT "/tmp/reg_pipe%d"
-#define SEGM_FORMAT "/tmp/MA%d.txt"
-#define SHM_SIZE 512
+#define FILENAME_SIZE 32
 #define SHM_NAME "rbc_data"
+#define RBC_MAX_EVENTS 64
+#define CACHE_LINE 64
 #define RBC_LOG "log/RBC.log"
 
 #pragma once
 
-int rbcPid;
+extern int rbcPid;
 int connectToFifo(const char*, int);
+int pipeOpen(const char *formatPipeC, const int pipeNum);
+void pipeClose(const char *formatPipeC, const int fdPipe, const int pipeNum);
 char* getCurrTime();
 
 void throwError(const char*);
-void trenoWait();
-void logUpdate();
 
 bool stationVerifier(char *str);
-bool isSegmentFree(char *);
+int32_t nodeParse(const char *str);
+void nodeFormat(const int32_t node, char *buf, const size_t len);
+
+// Node identifiers: stations are negative, segments positive, 0 is no position
+#define NODE_NONE 0
+#define NODE_STATION(n) (-(n))
+#define NODE_SEGM(n) (n)
+#define NODE_IS_STATION(node) ((node) < 0)
+#define NODE_NUM(node) ((node) < 0 ? -(node) : (node))
+#define NODE_NAME_SIZE 16
 
 // TYPEDEFS
 typedef struct cmd_args {
     int etcs;
     bool rbc;
-    int mappa;
+    char *scenario;
+    char *rbcMode;
+    char *trainMode;
+    char *timeMode;
 } cmd_args;
 typedef struct itin {
     char *start;
     char *end;
     char *path;
 } itin;
+// State of a station or a segment in the RBC data, alone on its cache line so that trains moving
+// on different nodes never write to the same line.
+typedef struct rbcNode_t {
+    _Atomic int32_t value;      // station: trains in the station; segment: train holding it, 0 when free
+    _Atomic int32_t queueHead;  // segment: first train of its queue (see rbcQueue.c), 0 when none waits for it
+    int32_t queueTail;          // segment: last train of its queue, under queueLock
+    _Atomic int32_t queueLock;
+    char pad[CACHE_LINE - 4 * sizeof(int32_t)];
+} __attribute__((aligned(CACHE_LINE))) rbcNode_t;
+// Seqlock word of a shard of the RBC data (see rbcData_t), alone on its cache line
+typedef struct rbcSeq_t {
+    _Atomic uint64_t seq;
+    char pad[CACHE_LINE - sizeof(uint64_t)];
+} __attribute__((aligned(CACHE_LINE))) rbcSeq_t;
+// Wait-for state of a train in the RBC data (see rbcDeadlock.c), alone on its cache line
+typedef struct rbcWait_t {
+    _Atomic uint64_t edge;      // train it waits for in the low half, segment that train holds in the high half, 0 if not waiting
+    _Atomic int32_t withdrawn;  // set when the train is withdrawn to break a deadlock
+    _Atomic int32_t queuedOn;   // segment whose queue its request waits in, RBC_QUEUE_HELD out of a section, 0 if none
+    int32_t queueNext;          // next train of that queue, under its queueLock
+    char pad[CACHE_LINE - sizeof(uint64_t) - 3 * sizeof(int32_t)];
+} __attribute__((aligned(CACHE_LINE))) rbcWait_t;
+#define WAIT_EDGE(holder, segm) (((uint64_t)(uint32_t)(segm) << 32) | (uint32_t)(holder))
+#define WAIT_HOLDER(edge) ((int32_t)(uint32_t)(edge))
+#define WAIT_SEGM(edge) ((int32_t)(uint32_t)((edge) >> 32))
+#define RBC_QUEUE_HELD -1
+// Requests waiting in the queues of the segments, alone on its cache line
+typedef struct rbcQueues_t {
+    _Atomic int32_t nWaiting;   // requests waiting
+    _Atomic uint32_t wake;      // bumped when a segment is freed while requests wait, futex word of the fork children
+    _Atomic int32_t sleepers;   // fork children sleeping on wake
+    char pad[CACHE_LINE - 3 * sizeof(int32_t)];
+} __attribute__((aligned(CACHE_LINE))) rbcQueues_t;
+// RBC state, sized from the topology and self-contained: it holds no pointer, every process mapping it
+// sees the same data. The station nodes are followed by the segment nodes, then by one seqlock word
+// per shard and by the wait-for state of each train: use RBC_STATION, RBC_SEGM, RBC_SEQ and RBC_WAIT to reach
+// them and RBC_DATA_SIZE to size the shared memory.
+// The seqlock words let readers take a consistent snapshot of every node (rbcDataSnapshot): their low half
+// counts the requests changing the state, their high half is bumped by each change, both with one atomic add.
+// The fork and epoll servers use shard 0 only, the sharded server one word per worker.
 typedef struct rbcData_t {
-    bool segms[N_SEGM];
-    int stations[N_STATIONS];
-    char *paths[N_TRAINS];
+    int32_t nStations;
+    int32_t nSegm;
+    int32_t nTrains;
+    int32_t nShards;
+    rbcQueues_t queues;
+    rbcNode_t nodes[];
 } rbcData_t;
+#define RBC_STATION(data, n) (&(data)->nodes[(n) - 1])
+#define RBC_SEGM(data, n) (&(data)->nodes[(data)->nStations + (n) - 1])
+#define RBC_SEQS(data) ((rbcSeq_t *)((data)->nodes + (data)->nStations + (data)->nSegm))
+#define RBC_SEQ(data, shard) (&RBC_SEQS(data)[shard].seq)
+#define RBC_SEQ_WRITERS(seq) ((uint32_t)(seq))
+#define RBC_SEQ_VERSION(seq) ((uint32_t)((seq) >> 32))
+#define RBC_WAIT(data, t) (&((rbcWait_t *)(RBC_SEQS(data) + (data)->nShards))[(t) - 1])
+#define RBC_DATA_SIZE(nStations, nSegm, nShards, nTrains) (sizeof(rbcData_t) + ((nStations) + (nSegm)) * sizeof(rbcNode_t) \
+        + (nShards) * sizeof(rbcSeq_t) + (nTrains) * sizeof(rbcWait_t))
 typedef itin railMaps[N_TRAINS];
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stdatomic.h>
+
+#pragma once
+
+// MACROS
+#define ITIN_SHM_NAME "/rail_itineraries"
+#define ITIN_PENDING 0
+#define ITIN_READY 1
+
+// TYPEDEFS
+// Itineraries of every train, published once by REGISTRO and mapped read-only by the trains.
+// ready is the futex word the trains sleep on until the table is published. The itinerary of TRENO i + 1
+// is the NUL-terminated "start-path-end" string at offsets[i] bytes from the start of the table.
+typedef struct itinTable_t {
+    _Atomic uint32_t ready;
+    int32_t nTrains;
+    uint64_t size;              // bytes of the whole table, valid once ready
+    uint32_t offsets[];
+} itinTable_t;
+
+void itinTableCreate();
+void itinTablePublish();
+const itinTable_t *itinTableAttach();
+const char *itinTableGet(const int trainNum);
+void itinTableDestroy();
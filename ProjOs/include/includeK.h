@@ -0,0 +1,71 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../include/includeP.h"
+
+#pragma once
+
+// MACROS
+#define STATS_SHM_NAME "rbc_stats"
+#define STATS_MAGIC 0x54534252         // "RBST"
+#define STATS_VERSION 3
+#define STATS_N_BUCKETS 24              // bucket i counts durations below 2^(i + STATS_MIN_SHIFT) ns, the last one the rest
+#define STATS_MIN_SHIFT 7               // first bucket: below 128 ns
+#define STATS_N_STATUS 6                // one per rbcStatus_t
+
+// TYPEDEFS
+// Stages of the handling of a request timed by the RBC
+typedef enum statsStage_t {
+    STATS_ACCEPT = 0,       // opening a session: accept, then the fork or the epoll registration
+    STATS_PARSE,            // checking and decoding a received frame
+    STATS_DECIDE,           // the decision of rbcAuthorize and the update of the RBC data
+    STATS_LOG,              // writing the decision to the RBC log
+    STATS_N_STAGES
+} statsStage_t;
+// Latency histogram of a stage, buckets on a log2 scale
+typedef struct statsHist_t {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sumNs;
+    _Atomic uint64_t buckets[STATS_N_BUCKETS];
+} statsHist_t;
+// Decisions on the requests to enter a segment
+typedef struct statsSegm_t {
+    _Atomic uint64_t granted;
+    _Atomic uint64_t denied;
+} statsSegm_t;
+// Statistics region, shared by the RBC and its children and mapped read-only by rbcstat.
+// Every field is only ever incremented or stored atomically, readers need no lock.
+typedef struct rbcStats_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nStages;
+    int32_t nSegm;
+    int32_t pid;                        // RBC server process
+    int64_t startTime;                  // wall-clock start of the RBC, seconds since the epoch
+    _Atomic uint64_t requests;          // request frames received
+    _Atomic uint64_t pushed;            // decisions pushed to queued requests, counted in status too
+    _Atomic uint64_t status[STATS_N_STATUS];   // replies by rbcStatus_t
+    _Atomic uint64_t sessionsAccepted;
+    _Atomic int64_t sessionsOpen;
+    _Atomic int64_t queueDepth;         // requests received and not answered yet, or ready sessions left in the epoll batch
+    _Atomic int64_t queueDepthMax;
+    _Atomic uint64_t deadlocks;         // wait-for cycles confirmed between trains
+    statsHist_t stages[STATS_N_STAGES];
+    statsSegm_t segms[];                // one per segment
+} rbcStats_t;
+
+extern rbcStats_t *rbcStats;
+
+rbcStats_t *statsCreate(const int nSegm);
+const rbcStats_t *statsAttach();
+void statsDestroy();
+
+uint64_t statsStart();
+void statsStage(const statsStage_t stage, const uint64_t startNs);
+void statsDecision(const int32_t nextNode, const rbcStatus_t status, const bool pushed);
+void statsQueue(const int64_t delta);
+void statsQueueSet(const int64_t depth);
+void statsSession(const bool opened);
+void statsDeadlock();
+uint64_t statsBucketBound(const int bucket);
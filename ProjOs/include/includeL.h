@@ -11,8 +11,39 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #pragma once
 
-void logUpdate();
-void rbcLogUpdate();
+// MACROS
+#define LOG_RING_SIZE 1024              // records, a power of two
+#define LOG_BATCH_SIZE 4096             // bytes written at once to a log file
+#define LOG_FLUSH_MS 100                // default time a record may wait before being written
+#define LOG_FLUSH_ENV "RAIL_LOG_FLUSH"  // "sync" writes every record at once, "batch" (default) batches them
+#define LOG_FLUSH_MS_ENV "RAIL_LOG_FLUSH_MS"
+#define LOG_FORMAT_ENV "RAIL_LOG_FORMAT"  // "text" (default), "binary" (see includeE.h) or "off"
+#define LOG_RBC 0                       // target of the RBC log, trains log to their own number
+
+// TYPEDEFS
+// Event to log, formatted by the writer thread.
+// target is LOG_RBC or the number of the train whose log is updated, positions are node identifiers.
+typedef struct logRecord_t {
+    int32_t target;
+    int32_t trainNum;
+    int32_t currNode;
+    int32_t nextNode;
+    bool auth;
+    uint64_t timeNs;
+} logRecord_t;
+// Slot of the ring buffer, seq tells whether the record has been published (see log.c)
+typedef struct logSlot_t {
+    atomic_size_t seq;
+    logRecord_t record;
+} logSlot_t;
+
+void logReset(const int trainNum);
+void rbcLogReset();
+void logUpdate(const int trainNum, const int32_t currNode, const int32_t nextNode);
+void rbcLogUpdate(const int trainNum, const int32_t currNode, const int32_t nextNode, const bool auth);
+void logFlush();
@@ -10,4 +10,43 @@
 
 #pragma once
 
-const railMaps maps[N_MAPS];
\ No newline at end of file
+// MACROS
+#define TOPO_LINE_SIZE 256
+#define MAP_MAGIC 0x3150414d        // "MAP1"
+#define MAP_STREAM_BUF 4096         // bytes buffered by each end of the map stream
+#define MAP_MAX_ITIN (1 << 20)      // longest itinerary accepted from the map stream
+
+// TYPEDEFS
+// Topology and scenario of a run: the network and the itinerary of every train.
+// trains[i] is the itinerary of TRENO i + 1, an empty start means the train has no itinerary and a NULL path
+// one planned by routePlan.
+// links are the pairs of adjacent nodes, encoded as in includeF.h.
+typedef struct topology_t {
+    int nStations;
+    int nSegm;
+    int nTrains;
+    itin *trains;
+    int nLinks;
+    int32_t (*links)[2];
+} topology_t;
+
+// Map stream sent by REGISTRO to the RBC: a header, then one record per train in train order, each followed by
+// the length bytes of its itinerary with no terminator, then an end record with trainNum 0
+typedef struct mapHeader_t {
+    uint32_t magic;
+    uint32_t nTrains;
+} mapHeader_t;
+typedef struct mapRecord_t {
+    uint32_t trainNum;
+    uint32_t length;
+} mapRecord_t;
+
+extern const railMaps maps[N_MAPS];
+extern topology_t topology;
+
+void topologyLoad(const char *scenario);
+char *itinToString(const itin *it);
+const char *routePlan(const int32_t start, const int32_t end);
+void routeTableReset();
+void mapToRbc();
+void mapFromRegistro(const int fd, char **dest);
@@ -0,0 +1,36 @@
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#pragma once
+
+// MACROS
+#define OCC_SHM_NAME "/rail_occupancy"
+#define SEGM_FREE 0
+#define SEGM_OCCUPIED 1
+#define SEGM_WAIT_TIMEOUT_MS 2000
+#define SEGM_RETRY_MS 100
+
+// TYPEDEFS
+// State of a segment: state is 0 when the segment is free, 1 when it is occupied.
+// Trains waiting for the segment to be released sleep on state as a futex, waiters counts them
+// so that releasing a segment nobody waits for costs no system call.
+typedef struct occSegm_t {
+    atomic_int state;
+    atomic_int waiters;
+} occSegm_t;
+// Occupancy table shared by PADRE_TRENI, TRENO and RBC, one entry per segment.
+typedef struct occTable_t {
+    int nSegm;
+    occSegm_t segms[];
+} occTable_t;
+
+void occupancySetName(const char *name);
+occTable_t *occupancyCreate(const int nSegm);
+occTable_t *occupancyAttach();
+void occupancyDestroy();
+
+bool segmClaim(const int segmNum);
+void segmRelease(const int segmNum);
+bool segmWait(const int segmNum, const int timeoutMs);
+void occupancySetReleaseHook(void (*hook)(const int segmNum));
+bool isSegmentFree(const int segmNum);
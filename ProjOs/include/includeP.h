@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#pragma once
+
+// MACROS
+#define RBC_PROTO_VERSION 1
+#define RBC_MSG_REQUEST 1
+#define RBC_MSG_REPLY 2
+#define RBC_MSG_RELEASE 3       // segment left inside a movement authority, not answered
+#define RBC_MSG_QUEUE 4         // request waiting in the queue of its segment instead of being denied as occupied
+#define RBC_MSG_RESENT 0x80     // flag of a request sent again on a session reconnected to a restarted RBC
+#define RBC_MSG_TYPE(type) ((type) & ~RBC_MSG_RESENT)
+#define RBC_MAX_AUTHORITY 255   // nodes of a movement authority
+#define RBC_MAX_PENDING 16
+#define RBC_RECONNECT_TRIES 30  // retry pauses a lost session waits for the RBC to be restarted
+
+// TYPEDEFS
+// Outcome of an authorization request
+typedef enum rbcStatus_t {
+    RBC_GRANTED = 0,        // TRENO may advance to the next node, and up to grantedNode
+    RBC_DENIED_OCCUPIED,    // the next segment is held by another TRENO
+    RBC_DENIED_MISMATCH,    // RBC state and occupancy table disagree
+    RBC_BAD_REQUEST,        // malformed request, wrong version or unknown node
+    RBC_DENIED_WITHDRAWN,   // TRENO withdrawn to break a deadlock: it leaves the line and ends its run
+    RBC_QUEUED              // the next segment is taken: the request waits in its queue, and is answered again once decided
+} rbcStatus_t;
+// Movement authority request, sent by TRENO over its session.
+// Frames are packed and in host byte order, both ends share the machine.
+// Nodes are encoded as in includeF.h: stations negative, segments positive.
+// A request asks for a movement authority of maxNodes nodes along the itinerary of the train, from
+// nextNode on; 0 and 1 ask for nextNode only. A release reports that the train left the segment currNode.
+// A queue frame is a request that, rather than being denied a segment held by another train, is answered
+// RBC_QUEUED and waits for it: the RBC pushes the grant, or another decision, with the same reqId.
+typedef struct __attribute__((packed)) rbcRequest_t {
+    uint8_t version;
+    uint8_t type;
+    uint16_t maxNodes;
+    uint32_t reqId;
+    int32_t trainNum;
+    int32_t currNode;
+    int32_t nextNode;
+} rbcRequest_t;
+// Reply sent by RBC, reqId matches the request being answered.
+// A granted authority covers nGranted nodes from nextNode, grantedNode is the last of them.
+typedef struct __attribute__((packed)) rbcReply_t {
+    uint8_t version;
+    uint8_t type;
+    uint8_t status;
+    uint8_t nGranted;
+    uint32_t reqId;
+    int32_t trainNum;
+    int32_t grantedNode;
+} rbcReply_t;
+// Long-lived connection from a TRENO to the RBC, or from a worker of the in-process scheduler
+// carrying the requests of many trains (trainNum is then 0 and only used in messages).
+// Replies received while waiting for a different request are kept in pending.
+// The session of a single train sends queue frames: the train has nothing else to do while it waits.
+// A session lost because the RBC stopped connects again to the restarted RBC and sends again the requests not
+// answered yet, kept by reqId in the ring sent (sentCap slots from oldestReqId on, version 0 once answered),
+// and the last releases.
+typedef struct rbcSession_t {
+    int fd;
+    int trainNum;
+    bool queued;
+    uint32_t nextReqId;
+    int nPending;
+    rbcReply_t pending[RBC_MAX_PENDING];
+    rbcRequest_t *sent;
+    uint32_t sentCap;
+    uint32_t oldestReqId;
+    uint32_t nReleased;
+    rbcRequest_t released[RBC_MAX_PENDING];
+} rbcSession_t;
+
+bool sendAll(const int fd, const void *buf, const size_t len);
+bool recvAll(const int fd, void *buf, const size_t len);
+
+rbcSession_t *rbcSessionOpen(const int trainNum);
+void rbcSessionClose(rbcSession_t *session);
+uint32_t rbcRequestSend(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode);
+uint32_t rbcAuthoritySend(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode, const int maxNodes);
+void rbcReleaseSend(rbcSession_t *session, const int trainNum, const int32_t node);
+rbcReply_t rbcReplyRecv(rbcSession_t *session, const uint32_t reqId);
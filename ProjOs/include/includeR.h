@@ -0,0 +1,134 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../include/includeF.h"
+#include "../include/includeP.h"
+
+#pragma once
+
+// MACROS
+#define RBC_MAX_SHARDS 64
+#define RBC_SHARDS_ENV "RAIL_RBC_SHARDS"    // workers of the sharded server, the online cores by default
+#define RBC_SHARD_QUEUE 4096                // requests waiting for a worker, power of two
+// Shard owning a segment: the segments are split in contiguous slices, consecutive segments of a route
+// mostly share their owner
+#define RBC_SEGM_SHARD(data, n) ((int)(((int64_t)(n) - 1) * (data)->nShards / (data)->nSegm))
+#define DEADLOCK_POLICY_ENV "RAIL_DEADLOCK_POLICY"     // hold (default), priority, detect or off, see rbcDeadlock.c
+#define RBC_QUEUE_CHECK_MS 2000             // a fork child checks its parked request at least this often
+#define RBC_CKPT_FILE "log/RBC.ckpt"        // checkpoint of the RBC state, see rbcCheckpoint.c
+#define RBC_CKPT_MAGIC 0x54504b43           // "CKPT"
+#define RBC_CKPT_VERSION 2
+#define RBC_JOURNAL_SIZE 8192               // entries of the journal ring, power of two
+#define RBC_SIGNAL_EVENT ((void *)-1)       // epoll data of the signal descriptor in the event loops of the RBC
+
+// TYPEDEFS
+// How two itineraries cross a segment they share
+typedef enum conflictDir_t {
+    CONFLICT_SAME = 0,      // same direction, one train follows the other
+    CONFLICT_OPPOSITE,      // opposite directions, the trains meet head-on
+    CONFLICT_CROSSING       // they enter or leave the segment through different nodes
+} conflictDir_t;
+// Answer of the RBC to the deadlocks between trains
+typedef enum deadlockPolicy_t {
+    DEADLOCK_HOLD = 0,      // hold trains out of single-track sections used by opposing trains, withdraw as below
+    DEADLOCK_PRIORITY,      // withdraw the train of lowest priority of each cycle
+    DEADLOCK_DETECT,        // only report the cycles
+    DEADLOCK_OFF            // no wait-for graph, for measures with trains that share their numbers
+} deadlockPolicy_t;
+// Header of the checkpoint file. The file holds this header, the snapshot of every node (stations, then
+// segments), the last move granted to each train, the journal ring, then the itineraries of the map one after the other, NUL-terminated.
+typedef struct rbcCkptHeader_t {
+    uint32_t magic;
+    uint32_t version;
+    int32_t nStations;
+    int32_t nSegm;
+    int32_t nTrains;
+    int32_t firstPid;                   // RBC that started the run
+    int32_t pid;                        // RBC running on the checkpoint, a restarted one after a restart
+    uint64_t journalOffset;
+    uint64_t mapOffset;
+    uint64_t mapLength;
+    _Atomic uint64_t head __attribute__((aligned(CACHE_LINE)));    // next journal slot
+    _Atomic uint64_t folded __attribute__((aligned(CACHE_LINE)));  // journal slots applied to the snapshot
+    _Atomic int32_t foldLock;
+} __attribute__((aligned(CACHE_LINE))) rbcCkptHeader_t;
+// Node of the checkpoint snapshot, seq is the last journal slot applied to it, plus one
+typedef struct rbcCkptNode_t {
+    int32_t value;
+    int32_t pad;
+    uint64_t seq;
+} rbcCkptNode_t;
+// Last move granted to a train by a request, currNode -> nextNode, seq as for the nodes
+typedef struct rbcCkptMove_t {
+    int32_t currNode;
+    int32_t nextNode;
+    uint64_t seq;
+} rbcCkptMove_t;
+// Entry of the journal: up to two changes of the RBC data made by one decision. A segment change gives the
+// train holding it after the change, 0 when freed, a station change the change of its train count.
+// The entry of a request granted gives its train and current node, trainNum is 0 for any other change.
+// seq is the slot of the entry plus one once it is written.
+typedef struct rbcJournalEntry_t {
+    _Atomic uint64_t seq;
+    int32_t node[2];
+    int32_t value[2];
+    int32_t trainNum;
+    int32_t currNode;
+} rbcJournalEntry_t;
+// Entry of the conflict index: a pair of itineraries sharing a segment, trainA < trainB
+typedef struct rbcConflict_t {
+    int32_t trainA;
+    int32_t trainB;
+    int32_t segm;
+    conflictDir_t dir;
+} rbcConflict_t;
+
+bool segmStatusChecker(rbcData_t *rbcData, const int32_t node);
+void rbcWriteBegin(rbcData_t *rbcData, const int shard);
+void rbcWriteEnd(rbcData_t *rbcData, const int shard, const bool changed);
+uint32_t rbcDataSnapshot(const rbcData_t *rbcData, int32_t *stations, int32_t *segms);
+bool nodeValid(const rbcData_t *rbcData, const int32_t node);
+bool rbcRequestValid(const rbcData_t *rbcData, const rbcRequest_t *request);
+bool rbcRequestReplay(const rbcRequest_t *request);
+rbcStatus_t rbcRequestCheck(rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        const bool replay, const bool headOn, int32_t *holder, int *waitSegm);
+rbcStatus_t rbcAuthorize(rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode, const bool replay,
+        int *waitSegm);
+void rbcRoutesInit(char **paths, const int nTrains, const int nSegm);
+bool rbcSegmShared(const int segmNum);
+bool rbcMovePrivate(const int trainNum, const int32_t currNode, const int32_t nextNode);
+const rbcConflict_t *rbcConflicts(int *nConflicts);
+bool rbcHeadOnBlocked(const rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        int32_t *blocker, int *blockerSegm);
+
+deadlockPolicy_t deadlockPolicy();
+void rbcWaitUpdate(rbcData_t *rbcData, const int trainNum, const rbcStatus_t status, const int32_t holder, const int segm);
+bool rbcWithdrawPending(const rbcData_t *rbcData, const int trainNum);
+void rbcWithdraw(rbcData_t *rbcData, const int shard, const int trainNum);
+void rbcWithdrawSetHook(void (*hook)(const int shard, const int owner, const int trainNum, const int segmNum));
+int rbcExtend(rbcData_t *rbcData, const int shard, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        const int maxNodes, const bool replay, int32_t *lastNode);
+void rbcHandleRelease(rbcData_t *rbcData, const int shard, const rbcRequest_t *release);
+rbcReply_t rbcHandleRequest(rbcData_t *rbcData, const rbcRequest_t *request);
+bool rbcQueueRetry(rbcData_t *rbcData, const rbcRequest_t *request, rbcReply_t *reply);
+
+int32_t rbcQueueHead(const rbcData_t *rbcData, const int segmNum);
+rbcStatus_t rbcQueueUpdate(rbcData_t *rbcData, const rbcRequest_t *request, const rbcStatus_t status, const int waitSegm);
+void rbcQueueLeave(rbcData_t *rbcData, const int trainNum);
+bool rbcQueueReady(const rbcData_t *rbcData, const int trainNum);
+void rbcQueueNotify(rbcData_t *rbcData);
+void rbcQueueSetHook(void (*hook)(void));
+rbcReply_t rbcQueueWait(rbcData_t *rbcData, const rbcRequest_t *request);
+
+void rbcCheckpointCreate(const rbcData_t *rbcData, char **paths);
+char **rbcCheckpointRecover(rbcData_t *rbcData);
+int rbcCheckpointCheck(const rbcData_t *rbcData);
+bool rbcCheckpointReplay(const int trainNum, const int32_t currNode, const int32_t nextNode);
+uint64_t rbcJournalReserve();
+void rbcJournalCommit(const uint64_t slot, const int32_t nodeA, const int32_t valueA, const int32_t nodeB, const int32_t valueB);
+void rbcJournalGrant(const uint64_t slot, const int trainNum, const int32_t currNode, const int32_t nodeA, const int32_t valueA,
+        const int32_t nodeB, const int32_t valueB);
+void rbcJournal(const int32_t nodeA, const int32_t valueA, const int32_t nodeB, const int32_t valueB);
+
+int rbcShardCount(const int nSegm);
+void rbcServeSharded(const int server_fd, const int signal_fd, rbcData_t *rbcData);
@@ -18,6 +18,14 @@
 
 #pragma once
 
-void signalHandler(int sign);
-void signalHandler2(int sign);
-void signalDone(char *paths[N_TRAINS]);
\ No newline at end of file
+// MACROS
+#define SUPERVISE_STOP_MS 5000      // a process asked to stop is killed after this delay
+
+int superviseInit();
+void superviseChild();
+pid_t superviseSpawn(const char *path, char *const argv[]);
+bool superviseSignal();
+int superviseRun(const bool stopOnFailure);
+void superviseTerminate(const pid_t pid, const int sig);
+void rbcShutdown();
+pid_t rbcRunningPid(const pid_t rbcPid);
@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../include/includeP.h"
+
+#pragma once
+
+// MACROS
+#define MA_LENGTH_ENV "RAIL_MA_LENGTH"     // nodes of the movement authorities asked for, 1 by default
+
+// TYPEDEFS
+// Itinerary compiled into node identifiers (see includeF.h), from the departure station to the
+// destination. nNodes is 0 when the train has no itinerary.
+typedef struct route_t {
+    int32_t *nodes;
+    int nNodes;
+} route_t;
+// Outcome of an attempt to advance
+typedef enum move_t {
+    MOVE_WAIT = 0,          // not authorized yet, the train waits and retries
+    MOVE_DONE,              // the train moved to the next node
+    MOVE_WITHDRAWN          // the RBC withdrew the train to break a deadlock, it left the line
+} move_t;
+
+extern const char *noPosition;
+extern const char *pathSeparator;
+
+int authorityLength();
+rbcReply_t advanceAppr(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode);
+move_t moveForward(rbcSession_t *session, const int trainNum, const route_t *route, const int pos, int *authEnd);
+void waitForRelease(const int32_t nextNode);
+const char* getIt(const int trainNum);
+route_t routeCompile(const char *itinerary);
+void routeFree(route_t *route);
@@ -3,12 +3,16 @@
 # Set default values for the ETCS and MAPPA options
 etcs=1          # ETCS1
 mappa=1         # MAPPA1
+rbcmode=fork    # RBC process per session
+trainmode=proc  # TRENO process per train
+timemode=real   # Wall clock
+topology=""     # Built-in map
 
 # Define a usage message to display when the -h option is used
-usage_msg="Usage: $(basename "$0") [-e arg] [-m arg]"
+usage_msg="Usage: $(basename "$0") [-e arg] [-m arg] [-f file] [-r fork|epoll|sharded] [-t proc|inproc] [-v]"
 
 # Process command line options
-while getopts ":e:m:h" flags; do
+while getopts ":e:m:f:r:t:vh" flags; do
     # Check the value of the flags variable
     if [[ $flags == "e" ]]; then
         # If the -e option is used, set the etcs variable to the value of OPTARG
@@ -16,6 +20,19 @@ while getopts ":e:m:h" flags; do
     elif [[ $flags == "m" ]]; then
         # If the -m option is used, set the mappa variable to the value of OPTARG
         mappa=${OPTARG}
+    elif [[ $flags == "f" ]]; then
+        # If the -f option is used, load the topology file instead of a built-in map
+        topology=${OPTARG}
+    elif [[ $flags == "r" ]]; then
+        # If the -r option is used, set the RBC server mode
+        rbcmode=${OPTARG}
+    elif [[ $flags == "t" ]]; then
+        # If the -t option is used, set how the TRENO are hosted
+        trainmode=${OPTARG}
+    elif [[ $flags == "v" ]]; then
+        # If the -v option is used, run on a virtual clock, which requires the TRENO hosted in PADRE_TRENI
+        timemode=virtual
+        trainmode=inproc
     elif [[ $flags == "h" ]]; then
         # If the -h option is used, display the usage message and exit
         echo "$usage_msg"
@@ -34,14 +51,21 @@ done
 # Shift the positional parameters after processing the options
 shift $((OPTIND-1))
 
+# A topology file replaces the built-in map
+scenario=MAPPA"$mappa"
+if [ -n "$topology" ]
+then
+    scenario=TOPOLOGY="$topology"
+fi
+
 # check the value of the etc variable
 if [ "$etcs" -eq 1 ]
 then
-    bin/SOProj ETCS"$etcs" MAPPA"$mappa" # Run the main executable with ETCS1 and MAPPA1
+    bin/SOProj ETCS"$etcs" "$scenario" "${trainmode^^}" "${timemode^^}" # Run the main executable with ETCS1 and MAPPA1
 elif [ "$etcs" -eq 2 ]
 then
-    bin/SOProj ETCS"$etcs" MAPPA"$mappa" RBC &
-    bin/SOProj ETCS"$etcs" MAPPA"$mappa" $!  # Run the main executable with ETCS2 and MAPPA1 in the background and run the main executable with ETCS2, MAPPA1, and RBC in the background
+    bin/SOProj ETCS"$etcs" "$scenario" RBC "${rbcmode^^}" "${timemode^^}" &
+    bin/SOProj ETCS"$etcs" "$scenario" "${trainmode^^}" "${timemode^^}" $!  # Run the main executable with ETCS2 and MAPPA1 in the background and run the main executable with ETCS2, MAPPA1, and RBC in the background
 else
     echo "ETCS$etcs invalid option" # Print an error message if the value of etcs is invalid
     exit 1
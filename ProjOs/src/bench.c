@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/includeF.h"
+#include "../include/includeL.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeT.h"
+#include "../include/includeM.h"
+#include "../include/includeC.h"
+
+// BENCH
+// Microbenchmarks of the hot path: position parsing, the occupancy primitives and the RBC decision
+// logic, run in isolation without sockets or processes. Usage: bin/bench [-n iterations] [-o file.json]
+// They use an occupancy table of their own and write their logs in a temporary directory, so that a simulation
+// running at the same time and the logs of the last run are left alone.
+
+// MACROS
+#define BENCH_ITERATIONS 1000000
+#define BENCH_MAX 16
+#define BENCH_LOG_DIR "/tmp/rail_bench_XXXXXX"
+
+// TYPEDEFS
+typedef struct benchResult_t {
+    const char *name;
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t allocs;
+} benchResult_t;
+
+// Allocations made by the code under test. The bench is linked with --wrap for these functions,
+// so only the calls made by the objects of the project are counted.
+static uint64_t benchAllocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+
+void *__wrap_malloc(size_t size) {
+    benchAllocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    benchAllocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    benchAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str) {
+    benchAllocs++;
+    return __real_strdup(str);
+}
+
+static benchResult_t results[BENCH_MAX];
+static int nResults = 0;
+
+static uint64_t benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Opens the measure of a benchmark, closed by benchEnd
+static benchResult_t *benchStart(const char *name) {
+    benchResult_t *result = &results[nResults++];
+    result->name = name;
+    result->allocs = benchAllocs;
+    result->ns = benchNow();
+    return result;
+}
+
+static void benchEnd(benchResult_t *result, const uint64_t ops) {
+    result->ns = benchNow() - result->ns;
+    result->allocs = benchAllocs - result->allocs;
+    result->ops = ops;
+    printf("%-32s %10llu ops %10.1f ns/op %10.2f Mops/s %8.3f allocs/op\n", result->name, (unsigned long long)ops,
+            (double)result->ns / ops, ops * 1000.0 / result->ns, (double)result->allocs / ops);
+}
+
+// Keeps the compiler from removing the benchmarked calls
+static volatile int64_t benchSink;
+
+static void benchNodeParse(const uint64_t n) {
+    const char *names[] = { "S1", "MA12", "MA3", "S8" };
+    benchResult_t *result = benchStart("nodeParse");
+    for(uint64_t i = 0; i < n; i++) benchSink += nodeParse(names[i & 3]);
+    benchEnd(result, n);
+}
+
+static void benchRouteCompile(const uint64_t n) {
+    const uint64_t ops = n / 10 ? n / 10 : 1;
+    benchResult_t *result = benchStart("routeCompile");
+    for(uint64_t i = 0; i < ops; i++) {
+        route_t route = routeCompile("S1-MA1-MA2-MA3-MA8-S6");
+        benchSink += route.nNodes;
+        routeFree(&route);
+    }
+    benchEnd(result, ops);
+}
+
+static void benchIsSegmentFree(const uint64_t n) {
+    benchResult_t *result = benchStart("isSegmentFree");
+    for(uint64_t i = 0; i < n; i++) benchSink += isSegmentFree(1 + (i % topology.nSegm));
+    benchEnd(result, n);
+}
+
+static void benchClaimRelease(const uint64_t n) {
+    benchResult_t *result = benchStart("segmClaim+segmRelease");
+    for(uint64_t i = 0; i < n; i++) {
+        const int segmNum = 1 + (i % topology.nSegm);
+        benchSink += segmClaim(segmNum);
+        segmRelease(segmNum);
+    }
+    benchEnd(result, n);
+}
+
+// RBC data of the built-in map, every segment free and no train in the stations
+static rbcData_t *benchRbcData() {
+    const size_t size = RBC_DATA_SIZE(topology.nStations, topology.nSegm, 1, topology.nTrains);
+    rbcData_t *rbcData = (rbcData_t *)aligned_alloc(CACHE_LINE, size);
+    if(!rbcData) throwError("Failed to allocate RBC data");
+    memset(rbcData, 0, size);
+    rbcData->nStations = topology.nStations;
+    rbcData->nSegm = topology.nSegm;
+    rbcData->nTrains = topology.nTrains;
+    rbcData->nShards = 1;
+    return rbcData;
+}
+
+// Request to enter a segment held by another train: denied without any change of state
+static void benchDenied(const uint64_t n) {
+    rbcData_t *rbcData = benchRbcData();
+    atomic_store(&RBC_SEGM(rbcData, 2)->value, 2);
+    segmClaim(2);
+    const rbcRequest_t request = { RBC_PROTO_VERSION, RBC_MSG_REQUEST, 0, 0, 1, NODE_SEGM(1), NODE_SEGM(2) };
+    benchResult_t *result = benchStart("rbcHandleRequest denied");
+    for(uint64_t i = 0; i < n; i++) benchSink += rbcHandleRequest(rbcData, &request).status;
+    benchEnd(result, n);
+    segmRelease(2);
+    free(rbcData);
+}
+
+// A train moving back and forth along its route: each operation is a granted request followed by
+// the occupancy updates the train makes, as in moveForward
+static void benchMove(const char *name, const uint64_t n) {
+    rbcData_t *rbcData = benchRbcData();
+    route_t route = routeCompile("S1-MA1-MA2-MA3-MA8-S6");
+    atomic_store(&RBC_STATION(rbcData, NODE_NUM(route.nodes[0]))->value, 1);
+    rbcRequest_t request = { RBC_PROTO_VERSION, RBC_MSG_REQUEST, 0, 0, 1, 0, 0 };
+    int pos = 0, dir = 1;
+    benchResult_t *result = benchStart(name);
+    for(uint64_t i = 0; i < n; i++) {
+        if(pos + dir < 0 || pos + dir >= route.nNodes) dir = -dir;
+        request.reqId = i;
+        request.currNode = route.nodes[pos];
+        request.nextNode = route.nodes[pos + dir];
+        if(rbcHandleRequest(rbcData, &request).status != RBC_GRANTED) throwError("Benchmark move denied");
+        if(!NODE_IS_STATION(request.nextNode)) segmClaim(NODE_NUM(request.nextNode));
+        if(!NODE_IS_STATION(request.currNode)) segmRelease(NODE_NUM(request.currNode));
+        pos += dir;
+    }
+    benchEnd(result, n);
+    if(!NODE_IS_STATION(route.nodes[pos])) segmRelease(NODE_NUM(route.nodes[pos]));
+    routeFree(&route);
+    free(rbcData);
+}
+
+// Writes the results as JSON, so that runs can be compared
+static void benchWrite(const char *path, const uint64_t n) {
+    FILE *file = fopen(path, "w");
+    if(!file) throwError("Failed to open benchmark output");
+    fprintf(file, "{\n  \"time\": %lld,\n  \"iterations\": %llu,\n  \"cpus\": %ld,\n  \"benchmarks\": [\n",
+            (long long)time(NULL), (unsigned long long)n, sysconf(_SC_NPROCESSORS_ONLN));
+    for(int i = 0; i < nResults; i++) {
+        fprintf(file, "    { \"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"allocs_per_op\": %.4f }%s\n",
+                results[i].name, (unsigned long long)results[i].ops, (double)results[i].ns / results[i].ops,
+                results[i].ops * 1e9 / results[i].ns, (double)results[i].allocs / results[i].ops, i + 1 < nResults ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Results written to %s\n", path);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = BENCH_ITERATIONS;
+    const char *output = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "n:o:h")) != -1) {
+        if(opt == 'n' && atoll(optarg) > 0) n = atoll(optarg);
+        else if(opt == 'o') output = optarg;
+        else {
+            fprintf(stderr, "Usage: %s [-n iterations] [-o file.json]\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    topologyLoad("1");
+    char occName[64];
+    snprintf(occName, sizeof(occName), "%s_bench_%d", OCC_SHM_NAME, (int)getpid());
+    occupancySetName(occName);
+    occupancyCreate(topology.nSegm);
+    // The decision logic is measured without its log, then with the binary and the text log
+    setenv(LOG_FORMAT_ENV, "off", 1);
+    benchNodeParse(n);
+    benchRouteCompile(n);
+    benchIsSegmentFree(n);
+    benchClaimRelease(n);
+    benchDenied(n);
+    benchMove("rbcHandleRequest move", n);
+    logFlush();
+    // The logs are written under log/ of the current directory: a temporary one
+    char logDir[] = BENCH_LOG_DIR;
+    const int cwd = open(".", O_RDONLY | O_DIRECTORY);
+    if(cwd == -1) throwError("Failed to open current directory");
+    if(!mkdtemp(logDir) || chdir(logDir) == -1) throwError("Failed to create benchmark log directory");
+    mkdir("log", 0777);
+    setenv(LOG_FORMAT_ENV, "binary", 1);
+    benchMove("rbcHandleRequest move+binlog", n);
+    logFlush();
+    setenv(LOG_FORMAT_ENV, "text", 1);
+    benchMove("rbcHandleRequest move+textlog", n);
+    logFlush();
+    rbcLogReset();
+    rmdir("log");
+    if(fchdir(cwd) == -1) throwError("Failed to return to current directory");
+    close(cwd);
+    rmdir(logDir);
+    occupancyDestroy();
+    if(output) benchWrite(output, n);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeE.h"
+
+// Binary event log: an append-only file of fixed-size records, written through a shared mapping.
+// Several processes may append to the same file (the RBC children in fork mode): slots are claimed
+// with an atomic increment of the header count, and the file is grown under an exclusive flock.
+
+// Size in bytes of a file holding capacity records
+static size_t evlogSize(const uint64_t capacity) {
+    return sizeof(evlogHeader_t) + capacity * sizeof(evlogRecord_t);
+}
+
+// Maps the whole file again after it has been grown
+static void evlogRemap(evlog_t *log) {
+    const uint64_t capacity = atomic_load(&log->header->capacity);
+    if(capacity == log->capacity) return;
+    munmap(log->header, evlogSize(log->capacity));
+    log->header = (evlogHeader_t *)mmap(NULL, evlogSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if(log->header == MAP_FAILED) throwError("Failed to map event log");
+    log->capacity = capacity;
+}
+
+// Doubles the file until it holds slot, unless another process already did
+static void evlogGrow(evlog_t *log, const uint64_t slot) {
+    if(flock(log->fd, LOCK_EX) == -1) throwError("Failed to lock event log");
+    uint64_t capacity = atomic_load(&log->header->capacity);
+    if(slot >= capacity) {
+        while(slot >= capacity) capacity *= 2;
+        if(ftruncate(log->fd, evlogSize(capacity)) == -1) throwError("Failed to grow event log");
+        atomic_store(&log->header->capacity, capacity);
+    }
+    flock(log->fd, LOCK_UN);
+    evlogRemap(log);
+}
+
+// evlogOpen maps an event log, creating it when it does not exist yet.
+// Parameters:
+//   - path: the event log file
+//   - wallOffsetNs: clockWallOffsetNs() of the producers, recorded in the header of a new file
+// Returns: the mapped log, to be released with evlogClose
+evlog_t *evlogOpen(const char *path, const int64_t wallOffsetNs) {
+    evlog_t *log = (evlog_t *)malloc(sizeof(evlog_t));
+    if(!log) throwError("Failed to allocate event log");
+    log->fd = open(path, O_CREAT | O_RDWR, 0666);
+    if(log->fd == -1) throwError("Failed to open event log");
+    // The first process to take the lock initializes the file
+    if(flock(log->fd, LOCK_EX) == -1) throwError("Failed to lock event log");
+    struct stat fs;
+    if(fstat(log->fd, &fs) == -1) throwError("Failed to get event log size");
+    const bool create = fs.st_size == 0;
+    if(create && ftruncate(log->fd, evlogSize(EVLOG_INITIAL_CAPACITY)) == -1) throwError("Failed to size event log");
+    log->capacity = create ? EVLOG_INITIAL_CAPACITY : (fs.st_size - sizeof(evlogHeader_t)) / sizeof(evlogRecord_t);
+    log->header = (evlogHeader_t *)mmap(NULL, evlogSize(log->capacity), PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if(log->header == MAP_FAILED) throwError("Failed to map event log");
+    if(create) {
+        log->header->magic = EVLOG_MAGIC;
+        log->header->version = EVLOG_VERSION;
+        log->header->recordSize = sizeof(evlogRecord_t);
+        log->header->wallOffsetNs = wallOffsetNs;
+        atomic_store(&log->header->count, 0);
+        atomic_store(&log->header->capacity, EVLOG_INITIAL_CAPACITY);
+    }
+    else if(log->header->magic != EVLOG_MAGIC || log->header->recordSize != sizeof(evlogRecord_t)) {
+        errno = EINVAL;
+        throwError("Invalid event log");
+    }
+    flock(log->fd, LOCK_UN);
+    return log;
+}
+
+// evlogAppend appends a record, the committed flag of the argument is ignored
+void evlogAppend(evlog_t *log, const evlogRecord_t *record) {
+    const uint64_t slot = atomic_fetch_add(&log->header->count, 1);
+    if(slot >= log->capacity) {
+        if(slot < atomic_load(&log->header->capacity)) evlogRemap(log);
+        else evlogGrow(log, slot);
+    }
+    evlogRecord_t *dest = (evlogRecord_t *)(log->header + 1) + slot;
+    dest->timeNs = record->timeNs;
+    dest->type = record->type;
+    dest->auth = record->auth;
+    dest->trainNum = record->trainNum;
+    dest->currNode = record->currNode;
+    dest->nextNode = record->nextNode;
+    atomic_store_explicit(&dest->committed, 1, memory_order_release);
+}
+
+void evlogClose(evlog_t *log) {
+    munmap(log->header, evlogSize(log->capacity));
+    close(log->fd);
+    free(log);
+}
@@ -6,6 +6,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "../include/includeF.h"
+#include "../include/includeC.h"
+#include "../include/includeM.h"
+
+// RBC process id, 0 when running in ETCS1
+int rbcPid;
 
 
 // This function checks whether a given string is a valid station identifier.
@@ -23,9 +28,9 @@ bool stationVerifier(char *str) {
     strcpy(id_str, str + 1);
     // Parse the integer value of the station identifier from the id_str string
     sscanf(id_str, "%d", &stationNum);
-    // If the integer value of the station identifier is not a positive integer between 1 and N_STATIONS (inclusive),
-    // it is an invalid station identifier
-    if (stationNum <= 0 || stationNum > N_STATIONS) {
+    // If the integer value of the station identifier is not a positive integer between 1 and the number of
+    // stations of the topology (inclusive), it is an invalid station identifier
+    if (stationNum <= 0 || stationNum > topology.nStations) {
         // Throw an error to indicate that the station identifier is invalid
         throwError("Station identifier error");
     }
@@ -33,9 +38,35 @@ bool stationVerifier(char *str) {
     return true;
 }
 
+// nodeParse converts a position name into its node identifier.
+// "S<n>" is station n, "MA<n>" is segment n and "--" (or an empty name) is no position.
+// Stations and segments must exist in the loaded topology.
+// Returns: the node identifier, throws an error on invalid names
+int32_t nodeParse(const char *str) {
+    int num;
+    if (str[0] == '\0' || !strcmp(str, "--")) return NODE_NONE;
+    if (sscanf(str, "S%d", &num) == 1) {
+        if (num <= 0 || num > topology.nStations) throwError("Station identifier error");
+        return NODE_STATION(num);
+    }
+    if (sscanf(str, "MA%d", &num) == 1) {
+        if (num <= 0 || num > topology.nSegm) throwError("Segment identifier error");
+        return NODE_SEGM(num);
+    }
+    throwError("Position identifier error");
+    return NODE_NONE;
+}
+
+// nodeFormat writes the position name of a node identifier into buf, the inverse of nodeParse
+void nodeFormat(const int32_t node, char *buf, const size_t len) {
+    if (node == NODE_NONE) snprintf(buf, len, "--");
+    else if (NODE_IS_STATION(node)) snprintf(buf, len, "S%d", NODE_NUM(node));
+    else snprintf(buf, len, "MA%d", NODE_NUM(node));
+}
+
 /* connectToFifo attempts to connect to the pipe specified by the given filename formatted using the given
  train number and returns the file descriptor for the pipe. If the connection request is unsuccessful,
- the function will retry every 1 second until a connection is established.
+ the function will retry every second (much sooner in virtual time runs) until a connection is established.
  Parameters:
    - formatPipeC: a string containing a format specifier for the desired pipe filename
    - trainNum: the train number to be used in formatting the desired pipe filename
@@ -43,8 +74,8 @@ bool stationVerifier(char *str) {
  
 int connectToFifo(const char* formatPipeC, int trainNum) {
     // Create the filename for the pipe using the provided format string and train number
-    char filename[16];
-    sprintf(filename, formatPipeC, trainNum);
+    char filename[FILENAME_SIZE];
+    snprintf(filename, sizeof(filename), formatPipeC, trainNum);
     // Print a message indicating that a connection request is being made
     if (trainNum == N_RBC_PIPE) {
         printf("RBC Connection request to %s.\n", filename);
@@ -56,8 +87,8 @@ int connectToFifo(const char* formatPipeC, int trainNum) {
     do {
         fd = open(filename, O_RDONLY);
         if (fd == -1) {
-            // Sleep for 1 second if the pipe could not be opened
-            sleep(1);
+            // Wait before retrying if the pipe could not be opened
+            clockRetryPause();
         }
     } while (fd == -1);
     // Print a message indicating that the connection was successful
@@ -70,63 +101,43 @@ int connectToFifo(const char* formatPipeC, int trainNum) {
     return fd;
 }
 
-// This function waits for all treno processes to terminate.
-// It continually calls the waitpid function until it returns a value less than or equal to 0,
-// indicating that there are no more child processes to wait for.
-// Between each call to waitpid, the function sleeps for 1 second to avoid busy waiting.
-void trenoWait() {
-    // Repeatedly call waitpid until it returns a value less than or equal to 0
-    while (waitpid(0, NULL, 0) > 0) {
-        // Sleep for 1 second between each call to waitpid to avoid busy waiting
-        sleep(1);
-    }
+// Creation and opening of REGISTRO pipe
+// This function creates and opens a pipe with a filename based on the given pipe number and format string
+int pipeOpen(const char *formatPipeC, const int pipeNum) {
+    // Generate the filename for the pipe based on the given pipe number and format string
+    char filename[FILENAME_SIZE];
+    snprintf(filename, sizeof(filename), formatPipeC, pipeNum);
+    // Remove the pipe if it already exists, then create a new one with the specified filename and permissions
+    unlink(filename);
+    mkfifo(filename, 0666);
+    // Open the pipe in write-only mode and store the file descriptor
+    int fd;
+    if((fd = open(filename, O_WRONLY)) == -1) throwError("Failed to open pipe");
+    // Return the file descriptor for the opened pipe
+    return fd;
 }
 
-
-bool isSegmentFree(char *segm) {
-    // Create the filename for the segment file
-    char filename[16];
-    sprintf(filename, "/tmp/%s.txt", segm);
-    // Open the segment file for reading
-    int fd;
-    if ((fd = open(filename, O_RDONLY, 0444)) == -1) {
-        // Throw an error if the file could not be opened
-        throwError("Error opening segment file, try again");
-    }
-    // Get the file info
-    struct stat fs;
-    if ((fstat(fd, &fs)) == -1) {
-        // Throw an error if the file info could not be retrieved
-        throwError("Error getting file info");
-    }
-    // Map the file into memory
-    char *mappedFile = (char *)mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (mappedFile == MAP_FAILED) {
-        // Throw an error if the file could not be mapped into memory
-        throwError("Error mapping file into memory");
-    }
-    // Read the file
-    const char fileContent = *mappedFile;
-    // Unmap the file from memory
-    if ((munmap(mappedFile, fs.st_size) == -1)) {
-        // Throw an error if the file could not be unmapped from memory
-        throwError("Error unmapping file from memory");
-    }
-    // Close the file
-    close(fd);
-    // Check the file content
-    if (fileContent != '0' && fileContent != '1') {
-        // Throw an error if the file content is invalid
-        throwError("Invalid file content");
-    }
-    // Return whether the segment is free
-    return fileContent == '0';
+// FD closure (and consecuently REGISTRO pipe elimination)
+// This function closes the given file descriptor and removes the pipe with the corresponding filename
+void pipeClose(const char *formatPipeC, const int fdPipe, const int pipeNum) {
+    // Close the given file descriptor
+    close(fdPipe);
+    // Generate the filename for the pipe based on the given pipe number and format string
+    char filename[FILENAME_SIZE];
+    snprintf(filename, sizeof(filename), formatPipeC, pipeNum);
+    // Remove the pipe with the generated filename
+    unlink(filename);
 }
 
+
+// Returns the current time as formatted by asctime, the simulated time in virtual time runs.
+// The string is kept in a per-thread buffer, so trains hosted as threads do not overwrite each other's.
 char* getCurrTime() {
-    const time_t now = time(NULL);
-    const struct tm *time_ptr = localtime(&now);
-    return asctime(time_ptr);
+    static __thread char timeStr[32];
+    const time_t now = clockWallTime();
+    struct tm time_val;
+    localtime_r(&now, &time_val);
+    return asctime_r(&time_val, timeStr);
 }
 
 // Error management
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "../include/includeF.h"
+#include "../include/includeI.h"
+#include "../include/includeM.h"
+
+// Itinerary table: REGISTRO hands the itineraries to the trains through one shared memory object.
+// The main process creates it empty before starting REGISTRO and PADRE_TRENI, so that it exists by the time
+// any train looks for it. REGISTRO sizes it, writes every itinerary once and sets ready; the trains sleep on
+// ready until then, then map the whole table read-only and read their itinerary in place.
+
+// Itinerary table mapped by the current process, NULL until attached. The trains hosted in PADRE_TRENI
+// attach from several threads, the first mapping published wins.
+static const itinTable_t *_Atomic itinTable = NULL;
+
+// The table is shared between processes, so the futex operations must not be process-private
+static void futexWait(const _Atomic uint32_t *word, const uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// itinTableCreate creates the empty itinerary table, replacing the one of a previous run
+void itinTableCreate() {
+    shm_unlink(ITIN_SHM_NAME);
+    // Readable by everyone, only REGISTRO writes it
+    const int fd = shm_open(ITIN_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if(fd == -1) throwError("itinTableCreate: failed to create itinerary table");
+    // ftruncate zeroes the header: ready is ITIN_PENDING
+    if(ftruncate(fd, sizeof(itinTable_t)) == -1) throwError("itinTableCreate: failed to size itinerary table");
+    close(fd);
+}
+
+// itinTablePublish writes the itineraries of the topology into the table and wakes the trains waiting for them.
+// It is called once by REGISTRO.
+void itinTablePublish() {
+    char *itineraries[topology.nTrains];
+    size_t size = sizeof(itinTable_t) + topology.nTrains * sizeof(uint32_t);
+    for(int i = 0; i < topology.nTrains; i++) {
+        itineraries[i] = itinToString(&topology.trains[i]);
+        size += strlen(itineraries[i]) + 1;
+    }
+    if(size > UINT32_MAX) {
+        errno = EFBIG;
+        throwError("itinTablePublish: itineraries too large");
+    }
+    const int fd = shm_open(ITIN_SHM_NAME, O_RDWR, 0);
+    if(fd == -1) throwError("itinTablePublish: failed to open itinerary table");
+    if(ftruncate(fd, size) == -1) throwError("itinTablePublish: failed to size itinerary table");
+    itinTable_t *table = (itinTable_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(table == MAP_FAILED) throwError("itinTablePublish: failed to map itinerary table");
+    close(fd);
+    table->nTrains = topology.nTrains;
+    table->size = size;
+    size_t offset = sizeof(itinTable_t) + topology.nTrains * sizeof(uint32_t);
+    for(int i = 0; i < topology.nTrains; i++) {
+        const size_t length = strlen(itineraries[i]) + 1;
+        memcpy((char *)table + offset, itineraries[i], length);
+        table->offsets[i] = offset;
+        offset += length;
+        printf("REGISTRO Published itinerary %s of TRENO %d.\n", itineraries[i], i + 1);
+        free(itineraries[i]);
+    }
+    // The itineraries are written before a train can see the table ready
+    atomic_store_explicit(&table->ready, ITIN_READY, memory_order_release);
+    futexWake(&table->ready);
+    munmap(table, size);
+}
+
+// itinTableAttach maps the itinerary table read-only into the current process, once it is published.
+// The mapping is done only once, following calls return the table already mapped.
+// Returns: the mapped itinerary table
+const itinTable_t *itinTableAttach() {
+    const itinTable_t *table = atomic_load(&itinTable);
+    if(table) return table;
+    const int fd = shm_open(ITIN_SHM_NAME, O_RDONLY, 0);
+    if(fd == -1) throwError("itinTableAttach: failed to open itinerary table");
+    // Only the header exists until REGISTRO publishes the itineraries
+    const itinTable_t *header = (const itinTable_t *)mmap(NULL, sizeof(itinTable_t), PROT_READ, MAP_SHARED, fd, 0);
+    if(header == MAP_FAILED) throwError("itinTableAttach: failed to map itinerary table");
+    // The kernel only puts the train to sleep if the table is still pending
+    while(atomic_load_explicit(&header->ready, memory_order_acquire) != ITIN_READY) futexWait(&header->ready, ITIN_PENDING);
+    const size_t size = header->size;
+    munmap((void *)header, sizeof(itinTable_t));
+    table = (const itinTable_t *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(table == MAP_FAILED) throwError("itinTableAttach: failed to map itinerary table");
+    close(fd);
+    const itinTable_t *expected = NULL;
+    if(!atomic_compare_exchange_strong(&itinTable, &expected, table)) {
+        munmap((void *)table, size);
+        return expected;
+    }
+    return table;
+}
+
+// itinTableGet returns the itinerary of a train ("S1-MA1-MA2-S6", "--" when there is none), waiting for
+// REGISTRO to publish it. The string lies in the shared table and must not be freed.
+const char *itinTableGet(const int trainNum) {
+    const itinTable_t *table = itinTableAttach();
+    if(trainNum <= 0 || trainNum > table->nTrains) {
+        errno = EINVAL;
+        throwError("Itinerary of an unknown train");
+    }
+    return (const char *)table + table->offsets[trainNum - 1];
+}
+
+// itinTableDestroy removes the itinerary table at the end of the run
+void itinTableDestroy() {
+    shm_unlink(ITIN_SHM_NAME);
+}
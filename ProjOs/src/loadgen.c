@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "../include/includeF.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeT.h"
+#include "../include/includeM.h"
+#include "../include/includeA.h"
+
+// LOADGEN
+// Synthetic load for the RBC: virtual trains request movement authorities over the TRENO sessions, as
+// fast as the RBC answers or with a think time between moves, and the latency of every request is measured.
+// The load generator plays the part of PADRE_TRENI (occupancy table) and REGISTRO (map sent to the RBC),
+// and with -r it also starts the RBC and terminates it at the end.
+// With -a the trains ask for movement authorities of several nodes and report the segments they leave.
+// Usage: bin/loadgen [-f scenario] [-n trains] [-c sessions] [-t think ms] [-d seconds] [-a nodes] [-r fork|epoll|sharded]
+
+// MACROS
+#define LOADGEN_DURATION 10
+#define LOADGEN_SESSIONS 4
+#define LOADGEN_DENIED_BACKOFF_US 100
+#define NS_PER_US 1000ULL
+
+// TYPEDEFS
+// Virtual train, circulating on the itinerary of a train of the topology: from the last station it
+// starts again from the first segment
+typedef struct vtrain_t {
+    int trainNum;
+    route_t route;
+    int pos;
+    int authEnd;            // index of the last node of the movement authority
+    bool granted;           // the RBC granted the next node on request and freed the current one, the move is due
+    uint64_t dueNs;         // time of the next request
+    bool inFlight;
+    uint32_t reqId;
+    uint64_t sentNs;
+} vtrain_t;
+// Session to the RBC and the virtual trains whose requests it carries
+typedef struct lgWorker_t {
+    pthread_t thread;
+    rbcSession_t *session;
+    vtrain_t *trains;
+    int nTrains;
+    uint64_t *latencies;
+    size_t nLatencies;
+    size_t capacity;
+    uint64_t granted;
+    uint64_t denied;
+    uint64_t claimFailed;
+    uint64_t moves;
+} lgWorker_t;
+
+static uint64_t thinkNs = 0;
+static int authority = 1;
+static uint64_t deadlineNs = 0;
+
+static uint64_t lgNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Index of the node after pos on the circulating route
+static int vtrainNext(const vtrain_t *train) {
+    return train->pos + 1 < train->route.nNodes ? train->pos + 1 : 1;
+}
+
+static void lgRecord(lgWorker_t *worker, const uint64_t latency) {
+    if(worker->nLatencies == worker->capacity) {
+        worker->capacity = worker->capacity ? 2 * worker->capacity : 4096;
+        worker->latencies = (uint64_t *)realloc(worker->latencies, worker->capacity * sizeof(uint64_t));
+        if(!worker->latencies) throwError("Failed to allocate latencies");
+    }
+    worker->latencies[worker->nLatencies++] = latency;
+}
+
+// Delay before a train asks again after a denial
+static uint64_t lgBackoffNs() {
+    return thinkNs > LOADGEN_DENIED_BACKOFF_US * NS_PER_US ? thinkNs : LOADGEN_DENIED_BACKOFF_US * NS_PER_US;
+}
+
+// Gives back the segments of the movement authority of a train past its next node, while it waits to enter it
+static void vtrainShorten(lgWorker_t *worker, vtrain_t *train) {
+    const int next = vtrainNext(train);
+    for(int i = next + 1; i <= train->authEnd; i++) {
+        if(!NODE_IS_STATION(train->route.nodes[i])) rbcReleaseSend(worker->session, train->trainNum, train->route.nodes[i]);
+    }
+    if(train->authEnd > next) train->authEnd = next;
+}
+
+// Applies a granted move to the occupancy table, as moveForward does. Inside a movement authority the segment
+// left is reported to the RBC, unless the RBC freed it when it granted the move.
+// Returns: false if the occupancy table shows the next segment as held, the train keeps the move and tries
+// again after a pause, like a TRENO
+static bool vtrainMove(lgWorker_t *worker, vtrain_t *train) {
+    const int next = vtrainNext(train);
+    const int32_t currNode = train->route.nodes[train->pos], nextNode = train->route.nodes[next];
+    if(!NODE_IS_STATION(nextNode) && !segmClaim(NODE_NUM(nextNode))) {
+        worker->claimFailed++;
+        vtrainShorten(worker, train);
+        return false;
+    }
+    if(!NODE_IS_STATION(currNode)) {
+        segmRelease(NODE_NUM(currNode));
+        if(!train->granted) rbcReleaseSend(worker->session, train->trainNum, currNode);
+    }
+    train->granted = false;
+    train->pos = next;
+    worker->moves++;
+    return true;
+}
+
+// Worker thread: sends the requests of every train that is due, then collects the replies.
+// The requests of a round are pipelined on the session, the RBC answers them in order.
+static void *lgWorkerRun(void *arg) {
+    lgWorker_t *worker = (lgWorker_t *)arg;
+    worker->session = rbcSessionOpen(0);
+    while(true) {
+        uint64_t now = lgNow();
+        if(now >= deadlineNs) break;
+        uint64_t nextDue = deadlineNs;
+        int sent = 0;
+        for(int i = 0; i < worker->nTrains; i++) {
+            vtrain_t *train = &worker->trains[i];
+            if(train->dueNs > now) {
+                if(train->dueNs < nextDue) nextDue = train->dueNs;
+                continue;
+            }
+            // Inside its movement authority the train moves without asking
+            const int next = vtrainNext(train);
+            if(train->granted || (next > train->pos && next <= train->authEnd)) {
+                train->dueNs = now + (vtrainMove(worker, train) ? thinkNs : lgBackoffNs());
+                continue;
+            }
+            train->sentNs = lgNow();
+            train->reqId = rbcAuthoritySend(worker->session, train->trainNum, train->route.nodes[train->pos], train->route.nodes[next], authority);
+            train->inFlight = true;
+            sent++;
+        }
+        for(int i = 0; i < worker->nTrains && sent > 0; i++) {
+            vtrain_t *train = &worker->trains[i];
+            if(!train->inFlight) continue;
+            const rbcReply_t reply = rbcReplyRecv(worker->session, train->reqId);
+            now = lgNow();
+            lgRecord(worker, now - train->sentNs);
+            train->inFlight = false;
+            if(reply.status == RBC_GRANTED) {
+                worker->granted++;
+                train->authEnd = reply.nGranted > 1 ? train->pos + reply.nGranted : vtrainNext(train);
+                train->granted = true;
+                train->dueNs = now + (vtrainMove(worker, train) ? thinkNs : lgBackoffNs());
+            }
+            else {
+                worker->denied++;
+                train->dueNs = now + lgBackoffNs();
+            }
+        }
+        // Nothing due yet: wait for the first train that is
+        if(sent == 0 && nextDue > now) {
+            const uint64_t wait = nextDue - now;
+            struct timespec ts = { wait / 1000000000ULL, wait % 1000000000ULL };
+            nanosleep(&ts, NULL);
+        }
+    }
+    rbcSessionClose(worker->session);
+    return NULL;
+}
+
+static int latencyCompare(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the latency below which a fraction q of the requests were answered
+static uint64_t percentile(const uint64_t *sorted, const size_t n, const double q) {
+    if(n == 0) return 0;
+    size_t i = (size_t)(q * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+// Starts the RBC on the scenario
+static pid_t lgStartRbc(const char *scenario, const char *mode) {
+    const pid_t pid = fork();
+    if(pid == -1) throwError("Failed to create RBC process");
+    if(pid == 0) {
+        // Virtual trains share the train numbers, a wait-for graph keyed by them sees cycles that are not
+        setenv(DEADLOCK_POLICY_ENV, "off", 0);
+        execl("./bin/rbc", "./bin/rbc", scenario, mode, NULL);
+        throwError("Failed to execute RBC process");
+    }
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    const char *scenario = "1";
+    const char *rbcMode = NULL;
+    int nTrains = 0, nSessions = LOADGEN_SESSIONS, duration = LOADGEN_DURATION, opt;
+    while((opt = getopt(argc, argv, "f:n:c:t:d:a:r:h")) != -1) {
+        switch(opt) {
+            case 'f': scenario = optarg; break;
+            case 'n': nTrains = atoi(optarg); break;
+            case 'c': nSessions = atoi(optarg); break;
+            case 't': thinkNs = (uint64_t)(atof(optarg) * NS_PER_MS); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'a': authority = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'r':
+                if(!strcmp(optarg, "fork")) rbcMode = "FORK";
+                else if(!strcmp(optarg, "epoll")) rbcMode = "EPOLL";
+                else if(!strcmp(optarg, "sharded")) rbcMode = "SHARDED";
+                else throwError("Invalid RBC mode");
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f scenario] [-n trains] [-c sessions] [-t think ms] [-d seconds] [-a nodes] [-r fork|epoll|sharded]\n", argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    topologyLoad(scenario);
+    // Itineraries the virtual trains circulate on
+    int routed[topology.nTrains], nRouted = 0;
+    for(int i = 0; i < topology.nTrains; i++) {
+        if(topology.trains[i].start[0] != '\0') routed[nRouted++] = i;
+    }
+    if(nRouted == 0) throwError("No itinerary in the topology");
+    if(nTrains <= 0) nTrains = nRouted;
+    if(nSessions <= 0 || duration <= 0) throwError("Invalid load generator arguments");
+    if(nSessions > nTrains) nSessions = nTrains;
+
+    // Same start-up as a run: the occupancy table, the RBC, then the map sent to it
+    occupancyCreate(topology.nSegm);
+    const pid_t rbcPid = rbcMode ? lgStartRbc(scenario, rbcMode) : 0;
+    mapToRbc();
+
+    lgWorker_t *workers = (lgWorker_t *)calloc(nSessions, sizeof(lgWorker_t));
+    if(!workers) throwError("Failed to allocate workers");
+    for(int w = 0; w < nSessions; w++) {
+        workers[w].trains = (vtrain_t *)calloc(nTrains / nSessions + 1, sizeof(vtrain_t));
+        if(!workers[w].trains) throwError("Failed to allocate virtual trains");
+    }
+    for(int v = 0; v < nTrains; v++) {
+        lgWorker_t *worker = &workers[v % nSessions];
+        vtrain_t *train = &worker->trains[worker->nTrains++];
+        const int t = routed[v % nRouted];
+        train->trainNum = t + 1;
+        char *itinerary = itinToString(&topology.trains[t]);
+        train->route = routeCompile(itinerary);
+        free(itinerary);
+    }
+    printf("LOADGEN %d virtual trains on %d sessions, think time %.3f ms, authorities of %d nodes, %d s\n", nTrains, nSessions, thinkNs / 1e6, authority, duration);
+    const uint64_t start = lgNow();
+    deadlineNs = start + duration * NS_PER_SEC;
+    for(int w = 0; w < nSessions; w++) {
+        if(pthread_create(&workers[w].thread, NULL, lgWorkerRun, &workers[w]) != 0) throwError("Failed to start worker");
+    }
+    uint64_t granted = 0, denied = 0, claimFailed = 0, moves = 0;
+    size_t nLatencies = 0;
+    for(int w = 0; w < nSessions; w++) {
+        pthread_join(workers[w].thread, NULL);
+        granted += workers[w].granted;
+        denied += workers[w].denied;
+        claimFailed += workers[w].claimFailed;
+        moves += workers[w].moves;
+        nLatencies += workers[w].nLatencies;
+    }
+    const double elapsed = (lgNow() - start) / 1e9;
+
+    // Latencies of every session, sorted for the percentiles
+    uint64_t *latencies = (uint64_t *)malloc((nLatencies ? nLatencies : 1) * sizeof(uint64_t));
+    if(!latencies) throwError("Failed to allocate latencies");
+    size_t n = 0;
+    for(int w = 0; w < nSessions; w++) {
+        memcpy(latencies + n, workers[w].latencies, workers[w].nLatencies * sizeof(uint64_t));
+        n += workers[w].nLatencies;
+    }
+    qsort(latencies, n, sizeof(uint64_t), latencyCompare);
+    printf("LOADGEN requests %zu (granted %llu, denied %llu, occupancy mismatches %llu) in %.2f s\n", n,
+            (unsigned long long)granted, (unsigned long long)denied, (unsigned long long)claimFailed, elapsed);
+    printf("LOADGEN throughput %.0f req/s, %.0f moves/s, %.2f requests per move\n", n / elapsed, moves / elapsed, moves ? (double)n / moves : 0.0);
+    printf("LOADGEN latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n", percentile(latencies, n, 0.5) / 1e3,
+            percentile(latencies, n, 0.99) / 1e3, percentile(latencies, n, 0.999) / 1e3, n ? latencies[n - 1] / 1e3 : 0.0);
+
+    if(rbcPid) {
+        kill(rbcPid, SIGUSR2);
+        waitpid(rbcPid, NULL, 0);
+    }
+    occupancyDestroy();
+    return EXIT_SUCCESS;
+}
@@ -1,66 +1,397 @@
 #include "includeF.h"
+#include "includeL.h"
+#include "includeC.h"
+#include "includeE.h"
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 //Log updates
 
-// logUpdate updates the log file for a train with the current and next positions of the train, as well as the current time.
-// Parameters:
-//   - trainNum: the number of the train whose log file is being updated
-//   - currPos: the current position of the train
-//   - nextPos: the next position of the train
-void logUpdate(int trainNum, char *currPos, char *nextPos) {
-    // Open the log file for writing, creating it if it doesn't exist and truncating it to zero length if it does exist
-    static int oFlags = O_CREAT | O_WRONLY | O_TRUNC;
-    char filename[16];
-    sprintf(filename, "log/T%d.log", trainNum);
+// Producers (TRENO, the agents of PADRE_TRENI, RBC) push fixed-size records into a lock-free ring
+// buffer and return at once. A writer thread, started on the first record of each process, formats
+// them and appends them to the log files in batches, keeping the files open across batches.
+// The ring is a bounded multi-producer single-consumer queue: a slot is free for the producer
+// claiming position pos when its seq is pos, and holds a published record when seq is pos + 1.
+// With RAIL_LOG_FORMAT=binary the records are appended to the binary event logs (see eventlog.c)
+// instead of being formatted, bin/logdump renders them back to text.
+
+// TYPEDEFS
+// Log file being written by the writer thread, lines are appended to buf until it is flushed.
+// In binary format records go straight to evlog.
+typedef struct logTarget_t {
     int fd;
-    if((fd = open(filename, oFlags, 0666)) == -1) {
-        throwError("Failed to open log file");
-    }
-    // First function call - oFlags setup
-    oFlags = O_CREAT | O_WRONLY | O_APPEND;
-    // Line to write on file
-    char writeLine[64] = { 0 };
-    sprintf(writeLine, "[Current: %s], [Next: %s], %s", currPos, nextPos, getCurrTime());
-    const size_t lineLength = strlen(writeLine) * sizeof(char);
-    if((write(fd, writeLine, lineLength)) == -1) {
-        throwError("Failed to write to log file");
+    evlog_t *evlog;
+    size_t len;
+    char buf[LOG_BATCH_SIZE];
+} logTarget_t;
+// Timestamp formatted for the last time seen, consecutive records rarely change second
+typedef struct logTime_t {
+    time_t time;
+    char str[32];
+} logTime_t;
+typedef struct logger_t {
+    logSlot_t slots[LOG_RING_SIZE];
+    atomic_size_t tail;             // next position claimed by a producer
+    size_t head;                    // next position read by the writer
+    atomic_bool running;
+    atomic_bool stopping;
+    atomic_int wakeSeq;             // futex word the writer sleeps on
+    atomic_bool sleeping;
+    bool sync;
+    bool binary;
+    bool off;
+    int flushMs;
+    int64_t wallOffsetNs;
+    pthread_mutex_t syncLock;       // protects targets with the sync policy and the binary format
+    bool registered;
+    pthread_mutex_t startLock;
+    pthread_t writer;
+    logTarget_t **targets;          // indexed by target, opened on first use
+    int nTargets;
+    logTime_t timeCache;
+} logger_t;
+
+static logger_t logger = { .startLock = PTHREAD_MUTEX_INITIALIZER, .syncLock = PTHREAD_MUTEX_INITIALIZER };
+
+// The ring and its futex are only used by the threads of one process
+static void futexWait(atomic_int *word, const int expected, const int timeoutMs) {
+    struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &timeout, NULL, 0);
+}
+
+static void futexWake(atomic_int *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Returns the asctime string of t, formatted again only when the second changes
+static const char *logTimeStr(logTime_t *cache, const time_t t) {
+    if(cache->str[0] == '\0' || cache->time != t) {
+        struct tm time_val;
+        localtime_r(&t, &time_val);
+        asctime_r(&time_val, cache->str);
+        cache->time = t;
+    }
+    return cache->str;
+}
+
+// Formats a record into the line written in its log file.
+// Returns: the length of the line
+static int logFormat(const logRecord_t *record, logTime_t *cache, char *line, const size_t size) {
+    const time_t time = (time_t)(((int64_t)record->timeNs + logger.wallOffsetNs) / 1000000000LL);
+    char currPos[NODE_NAME_SIZE], nextPos[NODE_NAME_SIZE];
+    nodeFormat(record->currNode, currPos, sizeof(currPos));
+    nodeFormat(record->nextNode, nextPos, sizeof(nextPos));
+    int length;
+    if(record->target == LOG_RBC) {
+        length = snprintf(line, size,
+                "[TRENO authorization request: T%d], [Current: %s], [Next: %s], [Authorized: %s], %s",
+                record->trainNum, currPos, nextPos, record->auth ? "SI" : "NO", logTimeStr(cache, time));
+    }
+    else {
+        length = snprintf(line, size, "[Current: %s], [Next: %s], %s", currPos, nextPos, logTimeStr(cache, time));
+    }
+    return length < (int)size ? length : (int)size - 1;
+}
+
+// Opens the log file of a target for appending
+static int logOpen(const int32_t target) {
+    char filename[FILENAME_SIZE];
+    if(target == LOG_RBC) snprintf(filename, sizeof(filename), "%s", RBC_LOG);
+    else snprintf(filename, sizeof(filename), "log/T%d.log", target);
+    const int fd = open(filename, O_CREAT | O_WRONLY | O_APPEND, 0666);
+    if(fd == -1) throwError(target == LOG_RBC ? "Failed to open RBC log file for writing" : "Failed to open log file");
+    return fd;
+}
+
+static void logAppend(const logRecord_t *record);
+
+// Writes a single record at once, used by the sync flush policy
+static void logWriteSync(const logRecord_t *record) {
+    if(logger.binary) {
+        // The event logs stay mapped, the producers share them
+        pthread_mutex_lock(&logger.syncLock);
+        logAppend(record);
+        pthread_mutex_unlock(&logger.syncLock);
+        return;
     }
+    static __thread logTime_t cache;
+    char line[128];
+    const int length = logFormat(record, &cache, line, sizeof(line));
+    const int fd = logOpen(record->target);
+    if(write(fd, line, length) == -1) throwError("Failed to write to log file");
     close(fd);
 }
 
-// RBC log update
-// Updates the RBC log file with a line containing information about a train's authorization request.
-void rbcLogUpdate(const int trainNum, char *currPos, char* nextPos, const bool auth) {
-    // Open RBC log file for writing
+static void logTargetFlush(logTarget_t *target) {
+    if(target->evlog || target->len == 0) return;
+    if(write(target->fd, target->buf, target->len) == -1) perror("Failed to write to log file");
+    target->len = 0;
+}
+
+// Appends a record to the batch of its log file
+static void logAppend(const logRecord_t *record) {
+    if(record->target >= logger.nTargets) {
+        const int nTargets = record->target + 1;
+        logger.targets = (logTarget_t **)realloc(logger.targets, nTargets * sizeof(logTarget_t *));
+        if(!logger.targets) throwError("Failed to allocate log targets");
+        for(int i = logger.nTargets; i < nTargets; i++) logger.targets[i] = NULL;
+        logger.nTargets = nTargets;
+    }
+    logTarget_t *target = logger.targets[record->target];
+    if(!target) {
+        target = (logTarget_t *)malloc(sizeof(logTarget_t));
+        if(!target) throwError("Failed to allocate log target");
+        target->fd = -1;
+        target->evlog = NULL;
+        if(logger.binary) {
+            char filename[FILENAME_SIZE];
+            if(record->target == LOG_RBC) snprintf(filename, sizeof(filename), "%s", EVLOG_RBC);
+            else snprintf(filename, sizeof(filename), EVLOG_TRAIN_FORMAT, record->target);
+            target->evlog = evlogOpen(filename, logger.wallOffsetNs);
+        }
+        else target->fd = logOpen(record->target);
+        target->len = 0;
+        logger.targets[record->target] = target;
+    }
+    if(target->evlog) {
+        const evlogRecord_t event = {
+            .timeNs = record->timeNs,
+            .type = record->target == LOG_RBC ? EVLOG_AUTH : EVLOG_POSITION,
+            .auth = record->auth,
+            .trainNum = record->trainNum,
+            .currNode = record->currNode,
+            .nextNode = record->nextNode
+        };
+        evlogAppend(target->evlog, &event);
+        return;
+    }
+    char line[128];
+    const int length = logFormat(record, &logger.timeCache, line, sizeof(line));
+    if(target->len + length > LOG_BATCH_SIZE) logTargetFlush(target);
+    memcpy(target->buf + target->len, line, length);
+    target->len += length;
+}
+
+// Moves every published record into the batches, then writes the batches.
+// Returns: the number of records written
+static int logDrain() {
+    int count = 0;
+    while(true) {
+        logSlot_t *slot = &logger.slots[logger.head & (LOG_RING_SIZE - 1)];
+        if(atomic_load_explicit(&slot->seq, memory_order_acquire) != logger.head + 1) break;
+        logAppend(&slot->record);
+        // The slot can be claimed again one lap later
+        atomic_store_explicit(&slot->seq, logger.head + LOG_RING_SIZE, memory_order_release);
+        logger.head++;
+        count++;
+    }
+    for(int i = 0; i < logger.nTargets; i++) {
+        if(logger.targets[i]) logTargetFlush(logger.targets[i]);
+    }
+    return count;
+}
+
+// Closes every log file of the process
+static void logTargetsClose() {
+    for(int i = 0; i < logger.nTargets; i++) {
+        if(logger.targets[i]) {
+            logTargetFlush(logger.targets[i]);
+            if(logger.targets[i]->evlog) evlogClose(logger.targets[i]->evlog);
+            else close(logger.targets[i]->fd);
+            free(logger.targets[i]);
+        }
+    }
+    free(logger.targets);
+    logger.targets = NULL;
+    logger.nTargets = 0;
+}
+
+// Writer thread: writes what has been pushed, then sleeps until the flush interval expires or
+// the ring starts filling up
+static void *logWriter(void *arg) {
+    (void)arg;
+    while(true) {
+        const int seen = atomic_load(&logger.wakeSeq);
+        logDrain();
+        if(atomic_load(&logger.stopping)) break;
+        atomic_store(&logger.sleeping, true);
+        futexWait(&logger.wakeSeq, seen, logger.flushMs);
+        atomic_store(&logger.sleeping, false);
+    }
+    // Records pushed before the stop request
+    logDrain();
+    logTargetsClose();
+    return NULL;
+}
+
+// Empty ring, every slot free for its first lap
+static void logRingInit() {
+    for(size_t i = 0; i < LOG_RING_SIZE; i++) atomic_init(&logger.slots[i].seq, i);
+    atomic_init(&logger.tail, 0);
+    logger.head = 0;
+}
+
+// A child process only has the thread that called fork: it starts its own writer on its first
+// record and must not write the records still pending in the parent
+static void logAtFork() {
+    atomic_init(&logger.running, false);
+    atomic_init(&logger.stopping, false);
+    atomic_init(&logger.sleeping, false);
+    logger.targets = NULL;
+    logger.nTargets = 0;
+    logger.startLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    logger.syncLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    logRingInit();
+}
+
+// Returns true when the logs are written in the binary event log format
+static bool logBinaryFormat() {
+    const char *format = getenv(LOG_FORMAT_ENV);
+    return format && !strcmp(format, "binary");
+}
+
+// Reads the flush policy and the format and starts the writer thread of the current process
+static void logStart() {
+    pthread_mutex_lock(&logger.startLock);
+    if(!atomic_load(&logger.running)) {
+        const char *policy = getenv(LOG_FLUSH_ENV);
+        const char *flushMs = getenv(LOG_FLUSH_MS_ENV);
+        logger.sync = policy && !strcmp(policy, "sync");
+        logger.binary = logBinaryFormat();
+        logger.off = getenv(LOG_FORMAT_ENV) && !strcmp(getenv(LOG_FORMAT_ENV), "off");
+        logger.wallOffsetNs = clockWallOffsetNs();
+        logger.flushMs = flushMs && atoi(flushMs) > 0 ? atoi(flushMs) : LOG_FLUSH_MS;
+        if(!logger.registered) {
+            pthread_atfork(NULL, NULL, logAtFork);
+            atexit(logFlush);
+            logger.registered = true;
+        }
+        if(!logger.sync && !logger.off) {
+            logRingInit();
+            atomic_store(&logger.stopping, false);
+            if(pthread_create(&logger.writer, NULL, logWriter, NULL) != 0) throwError("Failed to start log writer");
+        }
+        atomic_store(&logger.running, true);
+    }
+    pthread_mutex_unlock(&logger.startLock);
+}
+
+// Pushes a record into the ring. When the ring is full the producer waits for the writer to make room,
+// records are never dropped.
+static void logPush(const logRecord_t *record) {
+    if(!atomic_load(&logger.running)) logStart();
+    if(logger.off) return;
+    if(logger.sync) {
+        logWriteSync(record);
+        return;
+    }
+    size_t pos = atomic_load_explicit(&logger.tail, memory_order_relaxed);
+    logSlot_t *slot;
+    while(true) {
+        slot = &logger.slots[pos & (LOG_RING_SIZE - 1)];
+        const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&logger.tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if(diff < 0) {
+            // Ring full
+            atomic_fetch_add(&logger.wakeSeq, 1);
+            futexWake(&logger.wakeSeq);
+            sched_yield();
+            pos = atomic_load_explicit(&logger.tail, memory_order_relaxed);
+        }
+        else pos = atomic_load_explicit(&logger.tail, memory_order_relaxed);
+    }
+    slot->record = *record;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    // Wake the writer early every quarter of the ring, so that a burst does not fill it up
+    if((pos & (LOG_RING_SIZE / 4 - 1)) == LOG_RING_SIZE / 4 - 1 && atomic_load(&logger.sleeping)) {
+        atomic_fetch_add(&logger.wakeSeq, 1);
+        futexWake(&logger.wakeSeq);
+    }
+}
+
+// logFlush writes every pending record and stops the writer thread, a later record starts it again.
+// It is registered with atexit, so a process that exits does not lose the end of its logs.
+void logFlush() {
+    pthread_mutex_lock(&logger.startLock);
+    if(atomic_load(&logger.running) && !logger.sync && !logger.off) {
+        atomic_store(&logger.stopping, true);
+        atomic_fetch_add(&logger.wakeSeq, 1);
+        futexWake(&logger.wakeSeq);
+        pthread_join(logger.writer, NULL);
+    }
+    else if(atomic_load(&logger.running)) {
+        pthread_mutex_lock(&logger.syncLock);
+        logTargetsClose();
+        pthread_mutex_unlock(&logger.syncLock);
+    }
+    atomic_store(&logger.running, false);
+    pthread_mutex_unlock(&logger.startLock);
+}
+
+// logReset creates the log file of a train, truncating the log of a previous run.
+// The logs of a previous run in the other format are removed, a binary event log is created on the first event.
+// It is called once when the train starts, before any logUpdate.
+// Parameters:
+//   - trainNum: the number of the train whose log file is being created
+void logReset(const int trainNum) {
+    char filename[FILENAME_SIZE], evlogName[FILENAME_SIZE];
+    snprintf(filename, sizeof(filename), "log/T%d.log", trainNum);
+    snprintf(evlogName, sizeof(evlogName), EVLOG_TRAIN_FORMAT, trainNum);
+    unlink(evlogName);
+    if(logBinaryFormat()) {
+        unlink(filename);
+        return;
+    }
     int fd;
-    if ((fd = open(RBC_LOG, O_CREAT | O_WRONLY | O_APPEND, 0666)) == -1) {
-        // Throw error if file cannot be opened
-        throwError("Failed to open RBC log file for writing");
-    }
-    // Line to be written to the file
-    char writeLine[128] = { 0 };
-    // Get the string to use for the authorization value
-    char auth_str[3];
-    if (auth) {
-        strcpy(auth_str, "SI");
-    } else {
-        strcpy(auth_str, "NO");
-    }
-    // Format the line to be written to the file
-    sprintf(writeLine,
-            "[TRENO authorization request: T%d], [Current: %s], [Next: %s], [Authorized: %s], %s",
-            trainNum, currPos, nextPos, auth_str, getCurrTime());
-    // Size of bytes to be written to the file
-    const size_t lineLength = strlen(writeLine) * sizeof(char);
-    // Write line to file
-    if (write(fd, writeLine, lineLength) == -1) {
-        // Throw error if writing fails
-        throwError("Failed to write to RBC log file");
+    if((fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666)) == -1) {
+        throwError("Failed to create log file");
     }
     close(fd);
-}
\ No newline at end of file
+}
+
+// rbcLogReset removes the RBC logs of a previous run
+void rbcLogReset() {
+    unlink(RBC_LOG);
+    unlink(EVLOG_RBC);
+}
+
+// logUpdate updates the log file for a train with the current and next positions of the train, as well as the current time.
+// The line is written by the writer thread, NODE_NONE is logged as no position.
+// Parameters:
+//   - trainNum: the number of the train whose log file is being updated
+//   - currNode: the current position of the train
+//   - nextNode: the next position of the train
+void logUpdate(const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    const logRecord_t record = {
+        .target = trainNum,
+        .trainNum = trainNum,
+        .currNode = currNode,
+        .nextNode = nextNode,
+        .timeNs = clockNowNs()
+    };
+    logPush(&record);
+}
+
+// RBC log update
+// Updates the RBC log file with a line containing information about a train's authorization request.
+void rbcLogUpdate(const int trainNum, const int32_t currNode, const int32_t nextNode, const bool auth) {
+    const logRecord_t record = {
+        .target = LOG_RBC,
+        .trainNum = trainNum,
+        .currNode = currNode,
+        .nextNode = nextNode,
+        .auth = auth,
+        .timeNs = clockNowNs()
+    };
+    logPush(&record);
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeE.h"
+
+// LOGDUMP
+// Renders binary event logs (RAIL_LOG_FORMAT=binary) back to the text format of the T<n>.log and
+// RBC.log files, or to CSV for analysis. Usage: bin/logdump [-c] file.bin...
+
+// Prints a record in the text format of the log it comes from
+static void dumpText(const evlogRecord_t *record, const char *currPos, const char *nextPos, const time_t wall) {
+    struct tm time_val;
+    char timeStr[32];
+    localtime_r(&wall, &time_val);
+    asctime_r(&time_val, timeStr);
+    if(record->type == EVLOG_AUTH) {
+        printf("[TRENO authorization request: T%d], [Current: %s], [Next: %s], [Authorized: %s], %s",
+                record->trainNum, currPos, nextPos, record->auth ? "SI" : "NO", timeStr);
+    }
+    else printf("[Current: %s], [Next: %s], %s", currPos, nextPos, timeStr);
+}
+
+// Prints a record as a CSV row
+static void dumpCsv(const evlogRecord_t *record, const char *currPos, const char *nextPos, const int64_t wallNs) {
+    const time_t wall = (time_t)(wallNs / 1000000000LL);
+    struct tm time_val;
+    char timeStr[32];
+    localtime_r(&wall, &time_val);
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &time_val);
+    printf("%llu,%s.%09lld,%s,%d,%s,%s,%s\n", (unsigned long long)record->timeNs, timeStr, (long long)(wallNs % 1000000000LL),
+            record->type == EVLOG_AUTH ? "auth" : "position", record->trainNum, currPos, nextPos,
+            record->type == EVLOG_AUTH ? (record->auth ? "SI" : "NO") : "");
+}
+
+// Renders every committed record of an event log.
+// Returns: false if the file is not a valid event log
+static bool dumpFile(const char *path, const bool csv) {
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        perror(path);
+        return false;
+    }
+    struct stat fs;
+    if(fstat(fd, &fs) == -1 || (size_t)fs.st_size < sizeof(evlogHeader_t)) {
+        fprintf(stderr, "%s: not an event log\n", path);
+        close(fd);
+        return false;
+    }
+    const evlogHeader_t *header = (const evlogHeader_t *)mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    if(header->magic != EVLOG_MAGIC || header->version != EVLOG_VERSION || header->recordSize != sizeof(evlogRecord_t)) {
+        fprintf(stderr, "%s: not an event log\n", path);
+        munmap((void *)header, fs.st_size);
+        return false;
+    }
+    // Records claimed past the end of the file were being written while the file was grown
+    const uint64_t inFile = (fs.st_size - sizeof(evlogHeader_t)) / sizeof(evlogRecord_t);
+    uint64_t count = atomic_load(&header->count);
+    if(count > inFile) count = inFile;
+    const evlogRecord_t *records = (const evlogRecord_t *)(header + 1);
+    for(uint64_t i = 0; i < count; i++) {
+        const evlogRecord_t *record = &records[i];
+        if(!atomic_load_explicit(&record->committed, memory_order_acquire)) continue;
+        char currPos[NODE_NAME_SIZE], nextPos[NODE_NAME_SIZE];
+        nodeFormat(record->currNode, currPos, sizeof(currPos));
+        nodeFormat(record->nextNode, nextPos, sizeof(nextPos));
+        const int64_t wallNs = (int64_t)record->timeNs + header->wallOffsetNs;
+        if(csv) dumpCsv(record, currPos, nextPos, wallNs);
+        else dumpText(record, currPos, nextPos, (time_t)(wallNs / 1000000000LL));
+    }
+    munmap((void *)header, fs.st_size);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool csv = false;
+    int opt;
+    while((opt = getopt(argc, argv, "ch")) != -1) {
+        if(opt == 'c') csv = true;
+        else {
+            fprintf(stderr, "Usage: %s [-c] file.bin...\n  -c  CSV output instead of the text log format\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if(optind == argc) {
+        fprintf(stderr, "Usage: %s [-c] file.bin...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(csv) printf("time_ns,wall_time,type,train,current,next,authorized\n");
+    bool ok = true;
+    for(int i = optind; i < argc; i++) ok = dumpFile(argv[i], csv) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,6 +5,10 @@
 #include <unistd.h>
 
 #include "../include/includeF.h"
+#include "../include/includeI.h"
+#include "../include/includeL.h"
+#include "../include/includeM.h"
+#include "../include/includeS.h"
 
 // Global Constants
 const char *registro_exec = "./bin/registro";
@@ -12,62 +16,37 @@ const char *rbc_exec = "./bin/rbc";
 const char *padre_treni_exec = "./bin/padre_treni";
 const char *log_dir = "log";
 
-// execRegistro creates the REGISTRO and PADRE_TRENI processes. If the ETCS argument is 1, it also unlinks
-// the RBC_LOG file.
+// execRegistro creates the itinerary table and the REGISTRO and PADRE_TRENI processes. If the ETCS argument is 1,
+// it also unlinks the RBC_LOG file.
 // Parameters:
 //   - args: a struct containing the command line arguments passed to the main function, RBC PID for the SIGUSR2 signal is passed as an argument as well.
-// The function creates the REGISTRO and PADRE_TRENI processes and waits for them to finish
-// execution before returning
-void execRegistro(const cmd_args args) {
+// The function creates the REGISTRO and PADRE_TRENI processes and supervises them until both have exited: if one
+// fails, or the main process is asked to stop, PADRE_TRENI is stopped first, then REGISTRO.
+// Returns: the number of processes that failed
+int execRegistro(const cmd_args args) {
   // If ETCS is 1, unlink RBC_LOG
-  if (args.etcs == 1) unlink(RBC_LOG);
-  // Convert ETCS and map arguments to strings
-  char etcs_str[4], map_str[4];
+  if (args.etcs == 1) rbcLogReset();
+  // Convert ETCS argument to string, the scenario is passed as it is
+  char etcs_str[4];
   sprintf(etcs_str, "%d", args.etcs);
-  sprintf(map_str, "%d", args.mappa);
+  // Created before both processes start, so that the trains find it and wait for REGISTRO to fill it
+  itinTableCreate();
+  superviseInit();
   // REGISTRO process creation
-  pid_t pid;
-  switch (pid = fork()) {
-    case -1:
-      throwError("Fork failed to create REGISTRO process");
-      break;
-    case 0:
-      // Execute REGISTRO process
-      switch (execl(registro_exec, registro_exec, etcs_str, map_str, NULL)) {
-        case -1:
-          // Throw error if execl fails to execute REGISTRO process
-          throwError("Execl failed to execute REGISTRO process");
-          break;
-      }
-      break;
-    default:
-      printf("REGISTRO process created\n");
-      break;
-  }
+  char *registroArgs[] = { (char *)registro_exec, etcs_str, args.scenario, NULL };
+  superviseSpawn(registro_exec, registroArgs);
+  printf("REGISTRO process created\n");
   // PADRE_TRENI process creation
   char arg[256]; // RBC PID argument Variable
-    switch (pid = fork()) {
-    case -1:
-      // Throw error if fork fails to create PADRE_TRENI process
-      throwError("Fork failed to create PADRE_TRENI process");
-      break;
-    case 0:
-      // Execute PADRE_TRENI process
-      sprintf(arg, "%d", rbcPid); // Assignment of RBCPID
-      switch (execl(padre_treni_exec, padre_treni_exec, etcs_str, arg, NULL)) {
-        case -1:
-          // Throw error if execl fails to execute PADRE_TRENI process
-          throwError("Execl failed to execute PADRE_TRENI process");
-          break;
-      }
-      break;
-    default:
-      printf("PADRE_TRENI process created\n");
-      break;
-  }
+  sprintf(arg, "%d", rbcPid); // Assignment of RBCPID
+  char *padreTreniArgs[] = { (char *)padre_treni_exec, etcs_str, arg, args.scenario, args.trainMode, args.timeMode, NULL };
+  superviseSpawn(padre_treni_exec, padreTreniArgs);
+  printf("PADRE_TRENI process created\n");
   // Main process waiting for REGISTRO and PADRE_TRENI to finish execution
-  trenoWait();
+  const int failed = superviseRun(true);
+  itinTableDestroy();
   printf("REGISTRO, PADRE_TRENI: end of execution\n");
+  return failed;
 }
 
 
@@ -80,7 +59,11 @@ void execRegistro(const cmd_args args) {
 int main(int argc, char *argv[]) {
     // Initialize all arguments to 0
     cmd_args args;
-    args.etcs = args.mappa = args.rbc = 0;
+    args.etcs = args.rbc = 0;
+    args.scenario = NULL;
+    args.rbcMode = "FORK";
+    args.trainMode = "PROC";
+    args.timeMode = "REAL";
     for (int i = 1; i < argc; i++) {
         char* currentArg = argv[i];
         // Check if the current argument is an ETCS argument
@@ -92,16 +75,34 @@ int main(int argc, char *argv[]) {
         }
         // Check if the current argument is a MAPPA argument
         else if (strlen(currentArg) > 5 && !strncmp("MAPPA", currentArg, 5)) {
-            // Parse the MAPPA argument
-            if (sscanf(currentArg, "MAPPA%d", &args.mappa) != 1) {
+            // Parse the MAPPA argument, the built-in map is passed on as its number
+            int mappa;
+            if (sscanf(currentArg, "MAPPA%d", &mappa) != 1) {
                 throwError("Invalid MAPPA argument");
             }
+            args.scenario = currentArg + 5;
+        }
+        // Check if the current argument is a TOPOLOGY argument, a topology file used instead of a built-in map
+        else if (strlen(currentArg) > 9 && !strncmp("TOPOLOGY=", currentArg, 9)) {
+            args.scenario = currentArg + 9;
         }
         // Check if the current argument is an RBC argument
         else if (!strcmp("RBC", currentArg)) {
             // Set the RBC flag to true
             args.rbc = true;
         }
+        // Check if the current argument is an RBC server mode argument
+        else if (!strcmp("FORK", currentArg) || !strcmp("EPOLL", currentArg) || !strcmp("SHARDED", currentArg)) {
+            args.rbcMode = currentArg;
+        }
+        // Check if the current argument is a TRENO hosting mode argument
+        else if (!strcmp("PROC", currentArg) || !strcmp("INPROC", currentArg)) {
+            args.trainMode = currentArg;
+        }
+        // Check if the current argument is a time mode argument
+        else if (!strcmp("REAL", currentArg) || !strcmp("VIRTUAL", currentArg)) {
+            args.timeMode = currentArg;
+        }
         else if (atoi(currentArg) != 0){
             rbcPid = atoi(currentArg);
             printf("MAIN RBC PID: %d\n", rbcPid);
@@ -112,23 +113,29 @@ int main(int argc, char *argv[]) {
         }
     }
     // Check if the parsed argument values are valid
-    if (!(args.etcs > 0 && args.etcs <= N_ETCS) || !(args.mappa > 0 && args.mappa <= N_MAPS)) {
+    if (!(args.etcs > 0 && args.etcs <= N_ETCS) || !args.scenario) {
         throwError("Invalid values for ETCS or MAPPA arguments");
     }
+    // Load the topology once here, so that an invalid map or topology file is reported before any process starts
+    topologyLoad(args.scenario);
+    // Virtual time is only available with the trains hosted in PADRE_TRENI
+    if (!strcmp(args.timeMode, "VIRTUAL") && !strcmp(args.trainMode, "PROC") && !args.rbc) {
+        throwError("VIRTUAL requires INPROC");
+    }
     // Print parsed arguments
-    printf("ETCS%d MAPPA%d RBC=%d\n", args.etcs, args.mappa, args.rbc);
+    printf("ETCS%d MAPPA %s RBC=%d\n", args.etcs, args.scenario, args.rbc);
     // Create log directory
     mkdir(log_dir, 0777);
     // Check if ETCS is 2 and RBC flag is set
     if (args.etcs == 2 && args.rbc) {
         // Execute RBC process
-        if (execl(rbc_exec, rbc_exec, NULL) == -1) {
+        if (execl(rbc_exec, rbc_exec, args.scenario, args.rbcMode, args.timeMode, NULL) == -1) {
             throwError("Execl failed to execute RBC process");
         }
     }
     else {
         // Execute REGISTRO and PADRE_TRENI processes
-        execRegistro(args);
+        if (execRegistro(args) > 0) return EXIT_FAILURE;
     }
     // Return success
     return EXIT_SUCCESS;
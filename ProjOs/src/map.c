@@ -1,4 +1,5 @@
 #include "../include/includeF.h"
+#include "../include/includeM.h"
 
 
 // Maps
@@ -15,3 +16,251 @@ const railMaps maps[N_MAPS] = {
                 { "S6", "S1", "MA8-MA3-MA2-MA1" },
                 { "S5", "S1", "MA4-MA3-MA2-MA1" }}};
 
+// Topology of the current run, filled in by topologyLoad
+topology_t topology;
+
+// Stops the process on an invalid topology file
+static void topologyError(const char *scenario, const int lineNum, const char *msg) {
+    char errorMsg[TOPO_LINE_SIZE];
+    snprintf(errorMsg, sizeof(errorMsg), "Topology %s line %d: %s", scenario, lineNum, msg);
+    errno = EINVAL;
+    throwError(errorMsg);
+}
+
+// Adds a link between two adjacent nodes, the routes planned so far may change
+static void topologyLink(const int32_t from, const int32_t to) {
+    routeTableReset();
+    topology.links = realloc(topology.links, (topology.nLinks + 1) * sizeof(*topology.links));
+    if(!topology.links) throwError("Failed to allocate topology links");
+    topology.links[topology.nLinks][0] = from;
+    topology.links[topology.nLinks][1] = to;
+    topology.nLinks++;
+}
+
+// Adds the itinerary of the next train and a link between each pair of consecutive nodes of it
+static void topologyTrain(const char *start, const char *path, const char *end) {
+    topology.trains = realloc(topology.trains, (topology.nTrains + 1) * sizeof(itin));
+    if(!topology.trains) throwError("Failed to allocate topology trains");
+    itin *it = &topology.trains[topology.nTrains++];
+    it->start = strdup(start);
+    it->path = strdup(path);
+    it->end = strdup(end);
+    if(!it->start || !it->path || !it->end) throwError("Failed to allocate topology trains");
+    if(start[0] == '\0') return;
+    // nodeParse also checks that every node of the itinerary exists
+    char *nodes = itinToString(it);
+    char *cursor = nodes;
+    int32_t prev = nodeParse(strsep(&cursor, "-"));
+    char *name;
+    while((name = strsep(&cursor, "-"))) {
+        const int32_t node = nodeParse(name);
+        topologyLink(prev, node);
+        prev = node;
+    }
+    free(nodes);
+}
+
+// Adds a train whose itinerary is planned between two stations, when it is first asked for (see planner.c)
+static void topologyRoute(const char *scenario, const int lineNum, const char *start, const char *end) {
+    if(!NODE_IS_STATION(nodeParse(start)) || !NODE_IS_STATION(nodeParse(end))) topologyError(scenario, lineNum, "routes join two stations");
+    topology.trains = realloc(topology.trains, (topology.nTrains + 1) * sizeof(itin));
+    if(!topology.trains) throwError("Failed to allocate topology trains");
+    itin *it = &topology.trains[topology.nTrains++];
+    it->start = strdup(start);
+    it->path = NULL;
+    it->end = strdup(end);
+    if(!it->start || !it->end) throwError("Failed to allocate topology trains");
+}
+
+// Loads one of the built-in maps
+static void topologyBuiltin(const int n_map) {
+    topology.nStations = N_STATIONS;
+    topology.nSegm = N_SEGM;
+    for(int i = 0; i < N_TRAINS; i++) {
+        topologyTrain(maps[n_map - 1][i].start, maps[n_map - 1][i].path, maps[n_map - 1][i].end);
+    }
+}
+
+/* Loads a topology file. The file is made of lines of whitespace-separated fields, '#' starts a comment:
+     stations <n>                      number of stations, S1 .. S<n>
+     segments <n>                      number of segments, MA1 .. MA<n>
+     link <node> <node>                the two nodes are adjacent
+     train <start> <path> <end>        itinerary of the next train, e.g. train S1 MA1-MA2 S6
+     train --                          the next train has no itinerary
+     route <start> <end>               the next train goes from start to end, along the fastest route over the links
+   stations and segments must come before any link or train line. */
+static void topologyFile(const char *scenario) {
+    FILE *file = fopen(scenario, "r");
+    if(!file) throwError("Failed to open topology file");
+    char line[TOPO_LINE_SIZE];
+    int lineNum = 0;
+    while(fgets(line, sizeof(line), file)) {
+        lineNum++;
+        if(!strchr(line, '\n') && !feof(file)) topologyError(scenario, lineNum, "line too long");
+        char *comment = strchr(line, '#');
+        if(comment) *comment = '\0';
+        char key[16], first[TOPO_LINE_SIZE], second[TOPO_LINE_SIZE], third[TOPO_LINE_SIZE];
+        const int nFields = sscanf(line, "%15s %255s %255s %255s", key, first, second, third);
+        if(nFields <= 0) continue;
+        const bool sized = topology.nStations > 0 && topology.nSegm > 0;
+        if(!strcmp(key, "stations") && nFields == 2) topology.nStations = atoi(first);
+        else if(!strcmp(key, "segments") && nFields == 2) topology.nSegm = atoi(first);
+        else if(!sized) topologyError(scenario, lineNum, "stations and segments must come first");
+        else if(!strcmp(key, "link") && nFields == 3) topologyLink(nodeParse(first), nodeParse(second));
+        else if(!strcmp(key, "train") && nFields == 2 && !strcmp(first, "--")) topologyTrain("", "", "");
+        else if(!strcmp(key, "train") && nFields == 4) topologyTrain(first, second, third);
+        else if(!strcmp(key, "route") && nFields == 3) topologyRoute(scenario, lineNum, first, second);
+        else topologyError(scenario, lineNum, "invalid line");
+    }
+    fclose(file);
+    if(topology.nStations <= 0 || topology.nSegm <= 0) topologyError(scenario, lineNum, "missing stations or segments");
+    if(topology.nTrains == 0) topologyError(scenario, lineNum, "no train");
+    // Links may follow the route lines, the routes are checked once the whole file is read
+    for(int i = 0; i < topology.nTrains; i++) {
+        if(!topology.trains[i].path) routePlan(nodeParse(topology.trains[i].start), nodeParse(topology.trains[i].end));
+    }
+}
+
+// topologyLoad loads the topology of the run and sizes every table from it.
+// Parameters:
+//   - scenario: the number of a built-in map ("1", "2") or the path of a topology file
+void topologyLoad(const char *scenario) {
+    routeTableReset();
+    memset(&topology, 0, sizeof(topology));
+    char *end;
+    const long n_map = strtol(scenario, &end, 10);
+    if(*scenario != '\0' && *end == '\0') {
+        if(n_map <= 0 || n_map > N_MAPS) throwError("Invalid MAPPA");
+        topologyBuiltin(n_map);
+    }
+    else topologyFile(scenario);
+}
+
+// itinToString converts an itinerary into the "start-path-end" string sent to the trains, planning its route
+// when the topology only gives its stations.
+// Returns: a string allocated with malloc, "--" when the train has no itinerary
+char *itinToString(const itin *it) {
+    const char *path = it->path ? it->path : routePlan(nodeParse(it->start), nodeParse(it->end));
+    const size_t length = strlen(it->start) + strlen(path) + strlen(it->end) + 3;
+    char *str = (char *)malloc(length);
+    if(!str) throwError("Failed to allocate itinerary");
+    snprintf(str, length, "%s-%s-%s", it->start, path, it->end);
+    return str;
+}
+
+// Buffered end of the map stream: REGISTRO writes through it, the RBC reads through it
+typedef struct mapStream_t {
+    int fd;
+    size_t start, end;      // bytes buffered but not consumed yet
+    char buf[MAP_STREAM_BUF];
+} mapStream_t;
+
+// Writes the buffered bytes to the pipe
+static void mapStreamFlush(mapStream_t *stream) {
+    while(stream->start < stream->end) {
+        const ssize_t n = write(stream->fd, stream->buf + stream->start, stream->end - stream->start);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            throwError("Failed to write map to pipe");
+        }
+        stream->start += n;
+    }
+    stream->start = stream->end = 0;
+}
+
+// Appends len bytes to the stream, flushed whenever the buffer fills
+static void mapStreamWrite(mapStream_t *stream, const void *data, size_t len) {
+    const char *bytes = (const char *)data;
+    while(len > 0) {
+        if(stream->end == sizeof(stream->buf)) mapStreamFlush(stream);
+        const size_t chunk = len < sizeof(stream->buf) - stream->end ? len : sizeof(stream->buf) - stream->end;
+        memcpy(stream->buf + stream->end, bytes, chunk);
+        stream->end += chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+}
+
+// Reads exactly len bytes from the stream, refilling the buffer as the bytes arrive.
+// Returns: false if the writer closed the pipe first
+static bool mapStreamRead(mapStream_t *stream, void *data, size_t len) {
+    char *bytes = (char *)data;
+    while(len > 0) {
+        if(stream->start == stream->end) {
+            const ssize_t n = read(stream->fd, stream->buf, sizeof(stream->buf));
+            if(n == -1 && errno == EINTR) continue;
+            if(n == -1) throwError("Failed to read map from pipe");
+            if(n == 0) return false;
+            stream->start = 0;
+            stream->end = n;
+        }
+        const size_t chunk = len < stream->end - stream->start ? len : stream->end - stream->start;
+        memcpy(bytes, stream->buf + stream->start, chunk);
+        stream->start += chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Stops the RBC on a map stream it cannot use
+static void mapStreamError(const char *msg) {
+    errno = EPROTO;
+    throwError(msg);
+}
+
+// mapToRbc streams the itineraries of every train to the RBC through the REGISTRO pipe, one record each,
+// formatted as they are written so that no buffer holds the whole map.
+// It is used by REGISTRO in ETCS2 and by the load generator, which plays the part of REGISTRO.
+void mapToRbc() {
+    mapStream_t *stream = (mapStream_t *)malloc(sizeof(mapStream_t));
+    if(!stream) throwError("Failed to allocate map stream");
+    stream->fd = pipeOpen(PIPE_FORMAT, N_RBC_PIPE);
+    stream->start = stream->end = 0;
+    const mapHeader_t header = { MAP_MAGIC, topology.nTrains };
+    mapStreamWrite(stream, &header, sizeof(header));
+    size_t bytes = 0;
+    for(int i = 0; i < topology.nTrains; i++) {
+        char *itinerary = itinToString(&topology.trains[i]);
+        const mapRecord_t record = { i + 1, strlen(itinerary) };
+        mapStreamWrite(stream, &record, sizeof(record));
+        mapStreamWrite(stream, itinerary, record.length);
+        bytes += record.length;
+        free(itinerary);
+    }
+    const mapRecord_t end = { 0, 0 };
+    mapStreamWrite(stream, &end, sizeof(end));
+    mapStreamFlush(stream);
+    printf("Map of %d itineraries (%zu bytes) sent to RBC.\n", topology.nTrains, bytes);
+    pipeClose(PIPE_FORMAT, stream->fd, N_RBC_PIPE);
+    free(stream);
+}
+
+// mapFromRegistro reads the map streamed by mapToRbc, each itinerary as soon as its record has arrived.
+// Parameters:
+//   - fd: the read end of the REGISTRO pipe
+//   - dest: one itinerary per train of the topology, filled with strings allocated with malloc
+// Stops the RBC if the map is truncated or does not match the topology.
+void mapFromRegistro(const int fd, char **dest) {
+    mapStream_t *stream = (mapStream_t *)malloc(sizeof(mapStream_t));
+    if(!stream) throwError("Failed to allocate map stream");
+    stream->fd = fd;
+    stream->start = stream->end = 0;
+    mapHeader_t header;
+    if(!mapStreamRead(stream, &header, sizeof(header))) mapStreamError("Map from REGISTRO truncated");
+    if(header.magic != MAP_MAGIC) mapStreamError("Invalid map from REGISTRO");
+    if(header.nTrains != (uint32_t)topology.nTrains) mapStreamError("Map from REGISTRO does not match the topology");
+    for(int i = 0; i < topology.nTrains; i++) {
+        mapRecord_t record;
+        if(!mapStreamRead(stream, &record, sizeof(record))) mapStreamError("Map from REGISTRO truncated");
+        if(record.trainNum != (uint32_t)i + 1 || record.length > MAP_MAX_ITIN) mapStreamError("Invalid map from REGISTRO");
+        dest[i] = (char *)malloc(record.length + 1);
+        if(!dest[i]) throwError("Failed to allocate itinerary");
+        if(!mapStreamRead(stream, dest[i], record.length)) mapStreamError("Map from REGISTRO truncated");
+        dest[i][record.length] = '\0';
+    }
+    mapRecord_t end;
+    if(!mapStreamRead(stream, &end, sizeof(end))) mapStreamError("Map from REGISTRO truncated");
+    if(end.trainNum != 0 || end.length != 0) mapStreamError("Map from REGISTRO does not match the topology");
+    free(stream);
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "../include/includeF.h"
+#include "../include/includeO.h"
+
+// Occupancy table mapped by the current process, NULL until created or attached
+static occTable_t *occTable = NULL;
+// Name of the shared memory object of the table
+static const char *occName = OCC_SHM_NAME;
+// Called after every release made by the current process, used by the in-process scheduler
+static void (*releaseHook)(const int segmNum) = NULL;
+
+// Size in bytes of an occupancy table holding nSegm segments
+static size_t occupancySize(const int nSegm) {
+    return sizeof(occTable_t) + nSegm * sizeof(occSegm_t);
+}
+
+// occupancySetName gives the occupancy table of the process another name than OCC_SHM_NAME, before it is
+// created or attached: the benchmarks use a table of their own, not the one of a simulation running
+void occupancySetName(const char *name) {
+    occName = name;
+}
+
+// occupancyCreate creates the shared occupancy table and marks every segment as free.
+// It is called once by PADRE_TRENI before the TRENO processes are created.
+// Parameters:
+//   - nSegm: the number of segments of the topology
+// Returns: the mapped occupancy table
+occTable_t *occupancyCreate(const int nSegm) {
+    // Remove any table left over by a previous run so that it starts zeroed
+    shm_unlink(occName);
+    const int fd = shm_open(occName, O_CREAT | O_RDWR, 0666);
+    if(fd == -1) throwError("occupancyCreate: failed to create occupancy table");
+    const size_t size = occupancySize(nSegm);
+    if(ftruncate(fd, size) == -1) throwError("occupancyCreate: failed to size occupancy table");
+    occTable = (occTable_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(occTable == MAP_FAILED) throwError("occupancyCreate: failed to map occupancy table");
+    close(fd);
+    // 0 when the segment is free, 1 when it is occupied
+    occTable->nSegm = nSegm;
+    for(int i = 0; i < nSegm; i++) {
+        atomic_init(&occTable->segms[i].state, SEGM_FREE);
+        atomic_init(&occTable->segms[i].waiters, 0);
+    }
+    return occTable;
+}
+
+// occupancyAttach maps the occupancy table created by PADRE_TRENI into the current process.
+// The mapping is done only once, following calls return the table already mapped.
+// Returns: the mapped occupancy table
+occTable_t *occupancyAttach() {
+    if(occTable) return occTable;
+    const int fd = shm_open(occName, O_RDWR, 0666);
+    if(fd == -1) throwError("occupancyAttach: failed to open occupancy table");
+    // The table size depends on the topology, read it from the object itself
+    struct stat fs;
+    if(fstat(fd, &fs) == -1) throwError("occupancyAttach: failed to get occupancy table size");
+    occTable = (occTable_t *)mmap(NULL, fs.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(occTable == MAP_FAILED) throwError("occupancyAttach: failed to map occupancy table");
+    close(fd);
+    return occTable;
+}
+
+// occupancyDestroy unmaps and removes the occupancy table at the end of the run
+void occupancyDestroy() {
+    if(occTable) {
+        munmap(occTable, occupancySize(occTable->nSegm));
+        occTable = NULL;
+    }
+    shm_unlink(occName);
+}
+
+// Returns the entry associated to a segment, segments are numbered from 1
+static occSegm_t *segmEntry(const int segmNum) {
+    occTable_t *table = occupancyAttach();
+    if(segmNum <= 0 || segmNum > table->nSegm) throwError("Segment identifier error");
+    return &table->segms[segmNum - 1];
+}
+
+// The table is shared between processes, so the futex operations must not be process-private
+static int futexWait(atomic_int *word, const int expected, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static int futexWake(atomic_int *word, const int count) {
+    return syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+// segmClaim checks that a segment is free and occupies it in a single atomic step, so that two
+// trains can never both enter the same segment.
+// Parameters:
+//   - segmNum: the number of the segment to occupy
+// Returns: true if the segment was free and is now occupied by the caller, false otherwise
+bool segmClaim(const int segmNum) {
+    int expected = SEGM_FREE;
+    return atomic_compare_exchange_strong(&segmEntry(segmNum)->state, &expected, SEGM_OCCUPIED);
+}
+
+// segmRelease marks a segment as free and wakes the trains waiting for it
+// Parameters:
+//   - segmNum: the number of the segment being left
+void segmRelease(const int segmNum) {
+    occSegm_t *segm = segmEntry(segmNum);
+    atomic_store(&segm->state, SEGM_FREE);
+    if(atomic_load(&segm->waiters) > 0) futexWake(&segm->state, INT_MAX);
+    if(releaseHook) releaseHook(segmNum);
+}
+
+// occupancySetReleaseHook registers a function called each time the current process releases a segment.
+// Trains hosted as agents do not sleep on the futex, they are resumed by the hook instead.
+void occupancySetReleaseHook(void (*hook)(const int segmNum)) {
+    releaseHook = hook;
+}
+
+// segmWait parks the calling train until a segment is released or the timeout expires.
+// Parameters:
+//   - segmNum: the number of the segment the train is waiting for
+//   - timeoutMs: upper bound on the wait, in milliseconds
+// Returns: true if the segment was occupied when the wait started, false if it was already free
+bool segmWait(const int segmNum, const int timeoutMs) {
+    occSegm_t *segm = segmEntry(segmNum);
+    const struct timespec timeout = { .tv_sec = timeoutMs / 1000, .tv_nsec = (timeoutMs % 1000) * 1000000L };
+    // Register as a waiter before checking the state, so that a release in between is not missed
+    atomic_fetch_add(&segm->waiters, 1);
+    const bool occupied = atomic_load(&segm->state) == SEGM_OCCUPIED;
+    // The kernel only puts the train to sleep if the segment is still occupied
+    if(occupied) futexWait(&segm->state, SEGM_OCCUPIED, &timeout);
+    atomic_fetch_sub(&segm->waiters, 1);
+    return occupied;
+}
+
+// isSegmentFree reads the current status of a segment from the occupancy table.
+// Parameters:
+//   - segmNum: the number of the segment
+// Returns: true if the segment is free
+bool isSegmentFree(const int segmNum) {
+    return atomic_load(&segmEntry(segmNum)->state) == SEGM_FREE;
+}
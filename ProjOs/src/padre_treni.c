@@ -4,79 +4,67 @@
 
 #include "../include/includeF.h"
 #include "../include/includeS.h"
+#include "../include/includeO.h"
+#include "../include/includeA.h"
+#include "../include/includeC.h"
+#include "../include/includeM.h"
 
 const char* treno_exec = "./bin/treno";
 
 
-// createSegm modifies the state of a segment by creating or truncating its corresponding segment file and
-// writing the initial state of the segment to the file.
+// trenoSpawn creates a TRENO process for each train of the topology, supervised by PADRE_TRENI
 // Parameters:
-//   - segmNum: the number of the segment whose state is being modified
-
-void createSegm(const int segmNum) {
-    // Create the filename for the segment file
-    char filename[32];
-    sprintf(filename, SEGM_FORMAT, segmNum);
-    // Open the file for writing, creating it if it doesn't exist, and truncating it to zero length if it does exist
-    int fd;
-    if((fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0666)) == -1) {
-        // If the file couldn't be opened, throw an error
-        throwError("createSegm: opening Error");
-    }
-    // Write the initial state of the segment to the file
-    if(write(fd, "0", sizeof(char)) == -1) {
-        // If the write operation failed, throw an error
-        throwError("createSegm: writing Error");
-    }
-    // Write an empty character to the file
-    if(write(fd, "", sizeof(char)) == -1) {
-        // If the write operation failed, throw an error
-        throwError("createSegm: writing Error");
+//   - etcs_str: the ETCS level passed to each TRENO
+//   - scenario: the built-in map or topology file, every TRENO loads it as well
+void trenoSpawn(char *etcs_str, char *scenario) {
+    char tr_id_str[12];
+    char *trenoArgs[] = { (char *)treno_exec, tr_id_str, etcs_str, scenario, NULL };
+    for(int i=1; i<=topology.nTrains; i++) {
+        // Convert the train number to a string and execute the TRENO process
+        snprintf(tr_id_str, sizeof(tr_id_str), "%d", i);
+        superviseSpawn(treno_exec, trenoArgs);
+        printf("PADRE_TRENI created process for TRENO %d\n", i);
     }
-    // Close the file
-    close(fd);
 }
 
-// main is the entry point for the PADRE_TRENI process. It initializes the segment files, creates the TRENO processes, and waits for them to finish execution before deleting the segment files and returning.
+// main is the entry point for the PADRE_TRENI process. It loads the topology, creates the shared occupancy table sized from it, creates the TRENO processes, and waits for them to finish execution, then stops the RBC and waits for it before removing the occupancy table and returning.
+// Asked to stop (SIGTERM, SIGINT), it stops the TRENO processes and goes on the same way.
+// With the optional INPROC argument the trains are hosted as agents of the in-process scheduler instead of processes,
+// INPROC VIRTUAL also runs them on a virtual clock: travel times become events and the run takes no longer than the work it does.
 // Returns: 0 on success, a non-zero value on failure
 
 int main(int argc, char *argv[]) {
-    signal(SIGUSR1, signalHandler);
     printf("PADRE_TRENI Execution initialized.\n");
     // Check that the correct number of arguments was passed to the main function
-    if(argc != 3) throwError("PADRE_TRENI arguments invalid");
-    // Creates N_SEGM file, each one associated to a segment
-    for(int i=1; i<=N_SEGM; i++) createSegm(i);
-    char tr_id_str[4];
-    pid_t pid;
-    // Creates N_TRAINS processes, each one associated to a train
-    for(int i=1; i<=N_TRAINS; i++) {
-        if((pid = fork()) == 0) {
-            // Convert the train number to a string and execute the TRENO process
-            sprintf(tr_id_str, "%d", i);
-            execl(treno_exec, treno_exec, tr_id_str, argv[1], NULL);
-            throwError("PADRE_TRENI execl error");
-        }
-        else if(pid == -1) {
-            // Throw an error if the fork fails to create the TRENO process
-            throwError("PADRE_TRENI fork error");
-        }
-        printf("PADRE_TRENI created process for TRENO %d\n", i);
+    if(argc < 4 || argc > 6) throwError("PADRE_TRENI arguments invalid");
+    topologyLoad(argv[3]);
+    const bool inProcess = argc >= 5 && !strcmp(argv[4], "INPROC");
+    const bool virtualTime = argc == 6 && !strcmp(argv[5], "VIRTUAL");
+    if(virtualTime && !inProcess) throwError("PADRE_TRENI virtual time requires INPROC");
+    if(virtualTime) clockUseVirtual(true);
+    // Creates the occupancy table, one entry for each segment of the topology
+    occupancyCreate(topology.nSegm);
+    int failed = 0;
+    if(inProcess) {
+        // Every TRENO runs inside this process, schedRun returns when all of them have arrived
+        schedRun(topology.nTrains, atoi(argv[1]));
+    }
+    else {
+        // The trains are reaped as they arrive, their exit is their arrival
+        superviseInit();
+        trenoSpawn(argv[1], argv[3]);
+        // Process PADRE_TRENO waiting for TRENO
+        failed = superviseRun(false);
     }
-    // Process PADRE_TRENO waiting for TRENO
-    trenoWait();
     printf("TRENO processes terminated.\n");
     rbcPid = atoi(argv[2]);
-    // When in ETC 2 mode, use a SIGUSR signal to terminate RBC before terminating
+    // When in ETC 2 mode, use a SIGUSR signal to terminate RBC before terminating, the occupancy table is removed once it is gone
     if(rbcPid != 0) {
-        printf("Sending SIGUSR2 to RBC, pid: %d\n", rbcPid);
-        kill(rbcPid, SIGUSR2);
-    }
-    //Delete the segment files
-    char filename[32];
-    for(int i=1; i<=N_SEGM; i++) {
-        sprintf(filename, SEGM_FORMAT, i);
-        unlink(filename);
+        printf("Sending SIGUSR2 to RBC, pid: %d\n", rbcRunningPid(rbcPid));
+        superviseTerminate(rbcRunningPid(rbcPid), SIGUSR2);
     }
-    return EXIT_SUCCESS;
+    // Remove the occupancy table
+    occupancyDestroy();
+    if(virtualTime) clockDestroy();
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
\ No newline at end of file
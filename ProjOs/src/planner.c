@@ -0,0 +1,153 @@
+#include "../include/includeF.h"
+#include "../include/includeM.h"
+
+// Route planner: itineraries computed from the links of the topology instead of written by hand.
+// Stations and segments are the nodes of an undirected graph, the links its edges. A route runs from a station
+// to another one through segments only. Every node takes the same TRAVEL_TIME to cross, so the route with the
+// fewest segments is the fastest: a breadth-first search finds it as Dijkstra would with equal weights.
+// Routes are kept in a route table built on first use: one search from an origin gives the routes to every
+// destination, and each route string is formatted once. The table follows the links it was built from, it is
+// dropped by routeTableReset whenever the topology changes.
+
+// TYPEDEFS
+// Routes from one origin station: the predecessor of each node on its routes, and the route strings asked for
+typedef struct routeOrigin_t {
+    int32_t *pred;          // index of the previous node, -1 when the node is not reached
+    char **paths;           // path to each destination station, NULL until asked for
+} routeOrigin_t;
+typedef struct routeTable_t {
+    int nStations;
+    int nNodes;             // stations first, then segments
+    int *adjStart;          // neighbours of node i: adj[adjStart[i]] .. adj[adjStart[i + 1] - 1]
+    int *adj;
+    routeOrigin_t *origins; // one per station, pred NULL until a route from it is asked for
+} routeTable_t;
+
+static routeTable_t *routeTable = NULL;
+
+// Index of a node in the graph
+static int nodeIndex(const int32_t node) {
+    return NODE_IS_STATION(node) ? NODE_NUM(node) - 1 : topology.nStations + NODE_NUM(node) - 1;
+}
+
+// Node of an index of the graph
+static int32_t indexNode(const int index) {
+    return index < topology.nStations ? NODE_STATION(index + 1) : NODE_SEGM(index - topology.nStations + 1);
+}
+
+// Builds the adjacency lists of the graph from the links, in the order of the links
+static routeTable_t *routeTableBuild() {
+    routeTable_t *table = (routeTable_t *)calloc(1, sizeof(routeTable_t));
+    if(!table) throwError("Failed to allocate route table");
+    table->nStations = topology.nStations;
+    table->nNodes = topology.nStations + topology.nSegm;
+    table->adjStart = (int *)calloc(table->nNodes + 1, sizeof(int));
+    table->adj = (int *)malloc((2 * topology.nLinks + 1) * sizeof(int));
+    table->origins = (routeOrigin_t *)calloc(topology.nStations, sizeof(routeOrigin_t));
+    int *filled = (int *)calloc(table->nNodes, sizeof(int));
+    if(!table->adjStart || !table->adj || !table->origins || !filled) throwError("Failed to allocate route table");
+    for(int l = 0; l < topology.nLinks; l++) {
+        table->adjStart[nodeIndex(topology.links[l][0]) + 1]++;
+        table->adjStart[nodeIndex(topology.links[l][1]) + 1]++;
+    }
+    for(int i = 0; i < table->nNodes; i++) table->adjStart[i + 1] += table->adjStart[i];
+    for(int l = 0; l < topology.nLinks; l++) {
+        const int a = nodeIndex(topology.links[l][0]), b = nodeIndex(topology.links[l][1]);
+        table->adj[table->adjStart[a] + filled[a]++] = b;
+        table->adj[table->adjStart[b] + filled[b]++] = a;
+    }
+    free(filled);
+    return table;
+}
+
+// Searches the routes from an origin station: the search expands segments only, a station ends a route
+static void routeSearch(routeTable_t *table, const int origin) {
+    routeOrigin_t *from = &table->origins[origin];
+    from->pred = (int32_t *)malloc(table->nNodes * sizeof(int32_t));
+    from->paths = (char **)calloc(topology.nStations, sizeof(char *));
+    int *queue = (int *)malloc(table->nNodes * sizeof(int));
+    if(!from->pred || !from->paths || !queue) throwError("Failed to allocate route table");
+    for(int i = 0; i < table->nNodes; i++) from->pred[i] = -1;
+    int head = 0, tail = 0;
+    queue[tail++] = origin;
+    from->pred[origin] = origin;
+    while(head < tail) {
+        const int node = queue[head++];
+        for(int k = table->adjStart[node]; k < table->adjStart[node + 1]; k++) {
+            const int next = table->adj[k];
+            if(from->pred[next] != -1) continue;
+            // A station is reached, a route may not go through it
+            if(node == origin && next < topology.nStations) continue;
+            from->pred[next] = node;
+            if(next >= topology.nStations) queue[tail++] = next;
+        }
+    }
+    free(queue);
+}
+
+// Formats the route from origin to dest found by the search, NULL when there is none
+static char *routeFormat(const routeTable_t *table, const int origin, const int dest) {
+    const int32_t *pred = table->origins[origin].pred;
+    if(origin == dest || pred[dest] == -1) return NULL;
+    size_t length = 1;
+    int nSegm = 0;
+    for(int i = pred[dest]; i != origin; i = pred[i]) {
+        length += NODE_NAME_SIZE;
+        nSegm++;
+    }
+    int *segms = (int *)malloc(nSegm * sizeof(int));
+    char *path = (char *)malloc(length);
+    if(!segms || !path) throwError("Failed to allocate route");
+    int n = nSegm;
+    for(int i = pred[dest]; i != origin; i = pred[i]) segms[--n] = i;
+    size_t len = 0;
+    path[0] = '\0';
+    for(int s = 0; s < nSegm; s++) {
+        if(s > 0) path[len++] = '-';
+        nodeFormat(indexNode(segms[s]), path + len, length - len);
+        len += strlen(path + len);
+    }
+    free(segms);
+    return path;
+}
+
+// routePlan returns the fastest route between two stations over the links of the topology, the segments between
+// them joined with '-' as in an itinerary. The route string belongs to the route table.
+// Stops the process when the stations are not joined by segments.
+const char *routePlan(const int32_t start, const int32_t end) {
+    if(!NODE_IS_STATION(start) || !NODE_IS_STATION(end) || NODE_NUM(start) > topology.nStations || NODE_NUM(end) > topology.nStations) {
+        errno = EINVAL;
+        throwError("Route planned between unknown stations");
+    }
+    if(!routeTable) routeTable = routeTableBuild();
+    const int origin = nodeIndex(start), dest = nodeIndex(end);
+    routeOrigin_t *from = &routeTable->origins[origin];
+    if(!from->pred) routeSearch(routeTable, origin);
+    if(!from->paths[dest]) from->paths[dest] = routeFormat(routeTable, origin, dest);
+    if(!from->paths[dest]) {
+        char startName[NODE_NAME_SIZE], endName[NODE_NAME_SIZE], msg[3 * NODE_NAME_SIZE];
+        nodeFormat(start, startName, sizeof(startName));
+        nodeFormat(end, endName, sizeof(endName));
+        snprintf(msg, sizeof(msg), "No route %s-%s", startName, endName);
+        errno = EINVAL;
+        throwError(msg);
+    }
+    return from->paths[dest];
+}
+
+// routeTableReset drops the route table, the routes are searched again from the current links
+void routeTableReset() {
+    if(!routeTable) return;
+    for(int o = 0; o < routeTable->nStations; o++) {
+        routeOrigin_t *from = &routeTable->origins[o];
+        if(!from->pred) continue;
+        for(int d = 0; d < routeTable->nStations; d++) free(from->paths[d]);
+        free(from->paths);
+        free(from->pred);
+    }
+    free(routeTable->origins);
+    free(routeTable->adj);
+    free(routeTable->adjStart);
+    free(routeTable);
+    routeTable = NULL;
+}
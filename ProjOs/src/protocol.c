@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../include/includeF.h"
+#include "../include/includeP.h"
+#include "../include/includeC.h"
+
+// sendAll writes the whole buffer to a stream socket, retrying on short writes.
+// Returns: false if the peer closed the connection or an error occurred
+bool sendAll(const int fd, const void *buf, const size_t len) {
+    size_t sent = 0;
+    while(sent < len) {
+        const ssize_t n = send(fd, (const char *)buf + sent, len - sent, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// recvAll reads exactly len bytes from a stream socket, retrying on short reads.
+// Returns: false if the peer closed the connection or an error occurred
+bool recvAll(const int fd, void *buf, const size_t len) {
+    size_t received = 0;
+    while(received < len) {
+        const ssize_t n = recv(fd, (char *)buf + received, len - received, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+// Connects to the RBC server socket, retrying until the RBC listens or maxTries pauses passed (0 for no limit).
+// Returns: the connected socket, -1 when the RBC did not come up
+static int rbcConnect(const int maxTries) {
+    // Server address
+    struct sockaddr_un server_addr = { 0 };
+    struct sockaddr* server_addr_ptr = (struct sockaddr*) &server_addr;
+    socklen_t server_len = sizeof(server_addr);
+    // Socket creation
+    int client_fd;
+    if((client_fd = socket(AF_UNIX, SOCK_STREAM, DEFAULT_PROTOCOL)) == -1) {
+        throwError("Failed to create socket");
+    }
+    // Socket options
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, SERVER_NAME);
+    int connected, tries = 0;
+    do {
+        connected = connect(client_fd, server_addr_ptr, server_len);
+        if (connected == -1) {
+            if (maxTries > 0 && ++tries == maxTries) {
+                close(client_fd);
+                return -1;
+            }
+            clockRetryPause();
+        }
+    } while(connected == -1);
+    return client_fd;
+}
+
+// rbcSessionOpen establishes the connection between a train process and the RBC (Radio Block Center) process.
+// The connection is kept open for the whole run and carries every authorization request of the train.
+// Parameters:
+//   - trainNum: the number of the train process that is establishing the connection
+// Returns: the session used to send requests to the RBC
+rbcSession_t *rbcSessionOpen(const int trainNum) {
+    // TRENO tries to connect to RBC
+    printf("TRENO %d: Trying to form a connection to RBC.\n", trainNum);
+    const int client_fd = rbcConnect(0);
+    printf("TRENO %d Connection to RBC established.\n", trainNum);
+    rbcSession_t *session = (rbcSession_t *)calloc(1, sizeof(rbcSession_t));
+    if(!session) throwError("Failed to allocate RBC session");
+    session->fd = client_fd;
+    session->trainNum = trainNum;
+    session->queued = trainNum > 0;
+    session->nextReqId = 1;
+    session->oldestReqId = 1;
+    return session;
+}
+
+// rbcSessionClose closes the connection to the RBC and frees the session
+void rbcSessionClose(rbcSession_t *session) {
+    close(session->fd);
+    free(session->sent);
+    free(session);
+}
+
+// True if a request of the session is not answered yet
+static bool sessionUnanswered(const rbcSession_t *session, const uint32_t reqId) {
+    if(reqId - session->oldestReqId >= session->sentCap) return false;
+    const rbcRequest_t *request = &session->sent[reqId & (session->sentCap - 1)];
+    return request->reqId == reqId && request->version != 0;
+}
+
+// Moves oldestReqId to the oldest request not answered yet, up to limit
+static void sessionAdvance(rbcSession_t *session, const uint32_t limit) {
+    while(session->oldestReqId != limit && !sessionUnanswered(session, session->oldestReqId)) session->oldestReqId++;
+}
+
+// Keeps a request until it is answered, growing the ring to hold every request from the oldest unanswered one
+static void sessionTrack(rbcSession_t *session, const rbcRequest_t *request) {
+    sessionAdvance(session, request->reqId);
+    if(request->reqId - session->oldestReqId >= session->sentCap) {
+        uint32_t cap = session->sentCap ? session->sentCap : RBC_MAX_PENDING;
+        while(request->reqId - session->oldestReqId >= cap) cap *= 2;
+        rbcRequest_t *sent = (rbcRequest_t *)calloc(cap, sizeof(rbcRequest_t));
+        if(!sent) throwError("Failed to allocate RBC session");
+        for(uint32_t id = session->oldestReqId; id != request->reqId; id++) {
+            if(sessionUnanswered(session, id)) sent[id & (cap - 1)] = session->sent[id & (session->sentCap - 1)];
+        }
+        free(session->sent);
+        session->sent = sent;
+        session->sentCap = cap;
+    }
+    session->sent[request->reqId & (session->sentCap - 1)] = *request;
+}
+
+// Forgets a request once its final reply arrived
+static void sessionAnswered(rbcSession_t *session, const uint32_t reqId) {
+    if(sessionUnanswered(session, reqId)) session->sent[reqId & (session->sentCap - 1)].version = 0;
+    sessionAdvance(session, session->nextReqId);
+}
+
+// Connects the session again once the RBC closed it, to the RBC restarted from its checkpoint, and sends again
+// the frames it may have missed: the last releases, then the requests not answered yet. The RBC ignores a release
+// it applied already. The requests are flagged RBC_MSG_RESENT: the RBC grants again a move its checkpoint shows
+// it made before it stopped.
+static void sessionReconnect(rbcSession_t *session) {
+    while(true) {
+        close(session->fd);
+        printf("TRENO %d Connection to RBC lost, reconnecting.\n", session->trainNum);
+        session->fd = rbcConnect(RBC_RECONNECT_TRIES);
+        if(session->fd == -1) throwError("Failed to reconnect to RBC");
+        bool sent = true;
+        const uint32_t nReleased = session->nReleased < RBC_MAX_PENDING ? session->nReleased : RBC_MAX_PENDING;
+        for(uint32_t i = 0; i < nReleased && sent; i++) {
+            sent = sendAll(session->fd, &session->released[i], sizeof(rbcRequest_t));
+        }
+        for(uint32_t id = session->oldestReqId; id != session->nextReqId && sent; id++) {
+            if(!sessionUnanswered(session, id)) continue;
+            rbcRequest_t *request = &session->sent[id & (session->sentCap - 1)];
+            request->type |= RBC_MSG_RESENT;
+            sent = sendAll(session->fd, request, sizeof(rbcRequest_t));
+        }
+        if(sent) break;
+    }
+    printf("TRENO %d Connection to RBC established again.\n", session->trainNum);
+}
+
+// rbcRequestSend sends an authorization request to the RBC without waiting for the reply.
+// Several requests can be outstanding on the same session, each one is identified by its request ID.
+// Parameters:
+//   - session: the session to the RBC
+//   - trainNum: the train asking for the authorization
+//   - currNode: the current position of the train
+//   - nextNode: the position the train wants to advance to
+// Returns: the request ID to pass to rbcReplyRecv
+uint32_t rbcRequestSend(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    return rbcAuthoritySend(session, trainNum, currNode, nextNode, 1);
+}
+
+// rbcAuthoritySend sends a request for a movement authority of up to maxNodes nodes along the itinerary
+// of the train, from nextNode on, without waiting for the reply.
+// On the session of a single train the request waits in the RBC queue of the segment when it is taken.
+// Returns: the request ID to pass to rbcReplyRecv
+uint32_t rbcAuthoritySend(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode, const int maxNodes) {
+    const rbcRequest_t request = {
+        .version = RBC_PROTO_VERSION,
+        .type = session->queued ? RBC_MSG_QUEUE : RBC_MSG_REQUEST,
+        .maxNodes = maxNodes,
+        .reqId = session->nextReqId++,
+        .trainNum = trainNum,
+        .currNode = currNode,
+        .nextNode = nextNode
+    };
+    sessionTrack(session, &request);
+    // The request is sent again with the others once connected again
+    if(!sendAll(session->fd, &request, sizeof(request))) sessionReconnect(session);
+    return request.reqId;
+}
+
+// rbcReleaseSend reports to the RBC that the train left a segment of its movement authority.
+// The RBC does not answer, the train goes on at once.
+void rbcReleaseSend(rbcSession_t *session, const int trainNum, const int32_t node) {
+    const rbcRequest_t release = {
+        .version = RBC_PROTO_VERSION,
+        .type = RBC_MSG_RELEASE,
+        .reqId = session->nextReqId++,
+        .trainNum = trainNum,
+        .currNode = node,
+        .nextNode = NODE_NONE
+    };
+    session->released[session->nReleased++ % RBC_MAX_PENDING] = release;
+    if(!sendAll(session->fd, &release, sizeof(release))) sessionReconnect(session);
+}
+
+// rbcReplyRecv waits for the reply to a given request.
+// Replies to other outstanding requests that arrive first are kept until they are asked for.
+// Parameters:
+//   - session: the session to the RBC
+//   - reqId: the request ID returned by rbcRequestSend
+// Returns: the reply received from RBC
+rbcReply_t rbcReplyRecv(rbcSession_t *session, const uint32_t reqId) {
+    // Check the replies already received
+    for(int i = 0; i < session->nPending; i++) {
+        if(session->pending[i].reqId == reqId) {
+            const rbcReply_t reply = session->pending[i];
+            session->pending[i] = session->pending[--session->nPending];
+            return reply;
+        }
+    }
+    rbcReply_t reply;
+    while(true) {
+        if(!recvAll(session->fd, &reply, sizeof(reply))) {
+            sessionReconnect(session);
+            continue;
+        }
+        if(reply.version != RBC_PROTO_VERSION || reply.type != RBC_MSG_REPLY) throwError("Invalid reply from RBC");
+        // A queued request is answered again once decided
+        if(reply.status != RBC_QUEUED) sessionAnswered(session, reply.reqId);
+        if(reply.reqId == reqId) break;
+        if(session->nPending == RBC_MAX_PENDING) throwError("Too many outstanding RBC replies");
+        session->pending[session->nPending++] = reply;
+    }
+    return reply;
+}
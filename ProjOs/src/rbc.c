@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,64 +9,126 @@
 #include <sys/un.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <poll.h>
 
 #include "../include/includeF.h"
 #include "../include/includeL.h"
 #include "../include/includeS.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeC.h"
+#include "../include/includeM.h"
+#include "../include/includeR.h"
+#include "../include/includeK.h"
+
+// TYPEDEFS
+// TRENO session served by the event-driven server, request holds the frame being received and out the replies
+// the socket did not take yet
+typedef struct rbcConn_t {
+    int fd;
+    size_t len;
+    rbcRequest_t request;
+    char *out;
+    size_t outLen;
+    size_t outCap;
+    bool outWatched;        // watched for EPOLLOUT until out is sent
+} rbcConn_t;
+// Queued request parked by the event-driven server until it is decided, see rbcQueue.c
+typedef struct rbcParked_t {
+    rbcConn_t *conn;
+    rbcRequest_t request;
+} rbcParked_t;
+
+// Parked requests of the event-driven server, and the wake count of the RBC data they were last checked at
+static rbcParked_t *parked = NULL;
+static int nParked = 0, parkedCapacity = 0;
+static uint32_t parkedWake = 0;
+// Epoll instance of the event-driven server
+static int serveEpollFd = -1;
 
 
 /* Connects to the REGISTRO PIPE and reads the map data from it.
-   The map data is stored in the `dest` array.
+   The map data is stored in the `dest` array, which has one element for each train of the topology.
    Each element in the `dest` array is a string containing the path of a train.
    The connection to the REGISTRO PIPE is closed after the map data is read. */
-void rbcMaps(char *dest[N_TRAINS]) {
+void rbcMaps(char **dest) {
   int registroPipe = connectToFifo(PIPE_FORMAT, N_RBC_PIPE);
-  do {
-    char buffer[512] = {0};
-    if (read(registroPipe, buffer, sizeof(buffer)) == -1) {
-      throwError("Error reading from REGISTRO PIPE");
-    }
-    char *map = strdup(buffer);
-    // Copy itineraries from map into dest
-    char *path;
-    int i = 0;
-    while ((path = strsep(&map, "~"))) {
-      dest[i++] = strdup(path);
-    }
-    free(map);
-    free(path);
-  } while (false);
+  // The map is parsed record by record while REGISTRO is still sending it
+  mapFromRegistro(registroPipe, dest);
   close(registroPipe);
   printf("RBC Connection to registro pipe (fd=%d) interrupted.\n", registroPipe);
 }
 
-void rbcDataInit(rbcData_t *rbcData) {
+// Initializes the RBC data from the map sent by REGISTRO: every segment free, the trains in their first station.
+// A warm restart resumes from the checkpoint of the previous RBC of the run instead, see rbcCheckpoint.c.
+// The itineraries are only needed here and stay in the heap of the RBC, the shared memory holds no pointer.
+void rbcDataInit(rbcData_t *rbcData, const bool warm) {
     int stationNum;
-    char *str_ptr, *stationName;
-    // Set all segments to false
-    for (int i = 0; i < N_SEGM; i++) {
-        rbcData->segms[i] = false;
+    // Size the tables from the topology
+    rbcData->nStations = topology.nStations;
+    rbcData->nSegm = topology.nSegm;
+    rbcData->nTrains = topology.nTrains;
+    for (int i = 0; i < rbcData->nShards; i++) {
+        atomic_store(RBC_SEQ(rbcData, i), 0);
+    }
+    // No train waits for another, nor for a segment
+    for (int i = 1; i <= rbcData->nTrains; i++) {
+        atomic_store(&RBC_WAIT(rbcData, i)->edge, 0);
+        atomic_store(&RBC_WAIT(rbcData, i)->withdrawn, 0);
+        atomic_store(&RBC_WAIT(rbcData, i)->queuedOn, 0);
+    }
+    atomic_store(&rbcData->queues.nWaiting, 0);
+    atomic_store(&rbcData->queues.wake, 0);
+    atomic_store(&rbcData->queues.sleepers, 0);
+    // Set all segments free, with empty queues
+    for (int i = 1; i <= rbcData->nSegm; i++) {
+        atomic_store(&RBC_SEGM(rbcData, i)->value, 0);
+        atomic_store(&RBC_SEGM(rbcData, i)->queueHead, 0);
+        atomic_store(&RBC_SEGM(rbcData, i)->queueLock, 0);
     }
-    // Get map data and store it in rbcData->paths
-    rbcMaps(rbcData->paths);
     // Set all stations to 0
-    for (int i = 0; i < N_STATIONS; i++) {
-        rbcData->stations[i] = 0;
-    }
-    // Iterate through all trains
-    for (int i = 0; i < N_TRAINS; i++) {
-        // Duplicate the train's path string
-        str_ptr = strdup(rbcData->paths[i]);
-        // Get the first station in the train's path
-        stationName = strsep(&str_ptr, "-");
-        // If the first station is a valid station, increment the count for that station
-        if (stationVerifier(stationName)) {
-            sscanf(stationName, "S%d", &stationNum);
-            rbcData->stations[stationNum - 1]++;
+    for (int i = 1; i <= rbcData->nStations; i++) {
+        atomic_store(&RBC_STATION(rbcData, i)->value, 0);
+    }
+    char **paths;
+    if (warm) {
+        // The map and the state of the nodes come from the checkpoint, REGISTRO sent the map once
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        paths = rbcCheckpointRecover(rbcData);
+        const int mismatches = rbcCheckpointCheck(rbcData);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        int held = 0;
+        for (int i = 1; i <= rbcData->nSegm; i++) {
+            if (atomic_load(&RBC_SEGM(rbcData, i)->value) != 0) held++;
+        }
+        printf("RBC Warm restart from %s: %d segments held, %d occupancy mismatches, recovered in %.3f ms.\n", RBC_CKPT_FILE,
+                held, mismatches, (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    }
+    else {
+        // Get map data
+        paths = (char **)calloc(rbcData->nTrains, sizeof(char *));
+        if (!paths) throwError("Failed to allocate RBC paths");
+        rbcMaps(paths);
+        // Iterate through all trains
+        for (int i = 0; i < rbcData->nTrains; i++) {
+            // Get the first station in the train's path
+            char stationName[NODE_NAME_SIZE];
+            snprintf(stationName, sizeof(stationName), "%.*s", (int)strcspn(paths[i], "-"), paths[i]);
+            // If the first station is a valid station, increment the count for that station
+            if (stationVerifier(stationName)) {
+                sscanf(stationName, "S%d", &stationNum);
+                atomic_fetch_add(&RBC_STATION(rbcData, stationNum)->value, 1);
+            }
         }
+        rbcCheckpointCreate(rbcData, paths);
     }
-    // Free the duplicated station name string
-    free(stationName);
+    // Movement authorities follow the itineraries, compiled once
+    rbcRoutesInit(paths, rbcData->nTrains, rbcData->nSegm);
+    for (int i = 0; i < rbcData->nTrains; i++) free(paths[i]);
+    free(paths);
 }
 
 
@@ -88,108 +151,52 @@ int rbcServerSocket() {
         throwError("Failed to bind socket to server address");
     }
     // Start listening for requests on the socket
-    if (listen(fd, N_TRAINS) == -1) {
+    // Sessions are long-lived, the backlog only has to absorb the connections opened at startup
+    if (listen(fd, SOMAXCONN) == -1) {
         throwError("Failed to start listening on socket");
     }
     // Return the file descriptor for the socket
     return fd;
 }
 
-// Returns true if the segment has the correct status in the `rbcData` data structure, false otherwise.
-bool segmStatusChecker(rbcData_t *rbcData, int segmentID, char *segmentName, bool station) {
-    // If this is a station, return true
-    if (station) return true; 
-    // Get the value of the segment's status in the segment file
-    const bool segmentFileValue = !isSegmentFree(segmentName);
-    // Get the value of the segment's status in the RBC data
-    const bool rbcSegmentFileValue = rbcData->segms[segmentID - 1];
-    // Return true if the values match, false otherwise
-    return segmentFileValue == rbcSegmentFileValue;
-}
-
+/* Serves a session from a train (TRENO) in a child process of the RBC.
+The function takes in two parameters: an integer representing the file descriptor of the client socket connected to the TRENO, and the shared memory data structure inherited from the RBC.
+The function receives every request the TRENO sends over its session, lets rbcAuthorize decide on each of them and sends back the authorization decisions, until the TRENO closes the connection.
+A queued request is answered RBC_QUEUED at once, then the child waits for its decision and pushes it. */
 
-/* Serves a request from a train (TRENO) for authorization to advance to a new position.
-The function takes in a single parameter: an integer representing the file descriptor of the client socket connected to the TRENO.
-The function receives a message from the TRENO via the client socket, parses the message to obtain the TRENO's ID, current position, and next position, decides whether to authorize the TRENO to advance to the next position based on the status of the next position in a shared memory data structure and the status of the current and next positions, sends the authorization decision to the TRENO via the client socket, closes the client socket, and updates the shared memory data structure and an RBC log file with information about the TRENO's authorization request. */
-
-void requestS(int client_fd) {
-    // Create shared memory (SHM)
-    const int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if(shm_fd == -1) throwError("requestS: failed to create SHM");
-    // Create rbcData shared memory between RBC and its children
-    rbcData_t *rbcData = (rbcData_t*)mmap(0, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if(rbcData == MAP_FAILED) throwError("Failed to map rbcData to shared memory");
-    // Receive message from TRENO
-    char buffer[32] = { 0 };
-    if(recv(client_fd, buffer, sizeof(buffer), 0) == -1) throwError("Failed to receive message from TRENO");
-    char *msg_read = strdup(buffer);
-    const char str_sep = '~';
-    // Get TRENO ID
-    int trainNum;
-    char *tmp_str = strsep(&msg_read, &str_sep);
-    sscanf(tmp_str, "%d", &trainNum);
-    // Get TRENO current position
-    char *currPos = strsep(&msg_read, &str_sep);
-    // Get TRENO next position
-    char *nextPos = strsep(&msg_read, &str_sep);
-    // Check if currPos and nextPos are stations or segments
-    const bool currStation = stationVerifier(currPos);
-    const bool nextStation = stationVerifier(nextPos);
-// Get position IDs
-int currID, nextID;
-if(currStation) sscanf(currPos, "S%d", &currID);
-else sscanf(currPos, "MA%d", &currID);
-if(nextStation) sscanf(nextPos, "S%d", &nextID);
-else sscanf(nextPos, "MA%d", &nextID);
-// RBC decides if TRENO can advance
-const bool nextStaFree = (nextStation || !rbcData->segms[nextID - 1]);
-const bool nestSegSta = segmStatusChecker(rbcData, nextID, nextPos, nextStation);
-const bool currStaCorrect = segmStatusChecker(rbcData, currID, currPos, currStation);
-const bool auth = nextStaFree && nestSegSta && currStaCorrect;
-// RBC sends authorization to TRENO
-if(send(client_fd, &auth, sizeof(auth), 0) == -1) throwError("Failed to send authorization to TRENO");
-// TRENO has been executed 
-close(client_fd);
-    // rbcData updates on requests
-    if(auth) {
-        if(nextStation) {
-            rbcData->stations[nextID - 1]++;
-            // TRENO reached destination
-            kill(getppid(), SIGUSR1);
+void requestS(int client_fd, rbcData_t *rbcData) {
+    // Receive messages from TRENO until it closes its session
+    rbcRequest_t request;
+    while(recvAll(client_fd, &request, sizeof(request))) {
+        // Segments left inside a movement authority are not answered
+        if(request.type == RBC_MSG_RELEASE) {
+            rbcHandleRelease(rbcData, 0, &request);
+            continue;
+        }
+        // The queue depth counts the requests being served by every child
+        statsQueue(1);
+        // RBC decides if TRENO can advance
+        rbcReply_t reply = rbcHandleRequest(rbcData, &request);
+        // RBC sends authorization to TRENO
+        if(!sendAll(client_fd, &reply, sizeof(reply))) throwError("Failed to send authorization to TRENO");
+        statsQueue(-1);
+        if(reply.status == RBC_QUEUED) {
+            reply = rbcQueueWait(rbcData, &request);
+            if(!sendAll(client_fd, &reply, sizeof(reply))) throwError("Failed to send authorization to TRENO");
         }
-        else rbcData->segms[nextID - 1] = true;
-        if(currStation) rbcData->stations[currID - 1]--;
-        else rbcData->segms[currID - 1] = false;
-    }
-    // RBC updates log
-    rbcLogUpdate(trainNum, currPos, nextPos, auth);
-    // Remove access to shared memory
-    if((munmap(rbcData, SHM_SIZE)) == -1) throwError("requestS: unmapping shared memory failed");
-    // Close shared memory file descriptor
-    close(shm_fd);
-// Free allocated memory
-    free(tmp_str);
-    free(msg_read);
+    }
+    // TRENO has been executed 
+    statsSession(false);
+    close(client_fd);
     exit(EXIT_SUCCESS); 
 }
 
-// RBC MAIN
-/* This is the main function of the RBC program. It creates a shared memory segment and server socket, initializes the shared memory data structure, sets a signal handler, checks for empty paths in the shared memory data, removes the RBC log file if it exists, and runs the RBC server. */
-
-int main(void) {
-    signal(SIGUSR1, signalHandler); // Set signal handler for SIGUSR1
-    signal(SIGUSR2, signalHandler2); // Set signal handler for SIGUSR2
-    printf("RBC Execution initialized.\n");
-    const int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    if(shm_fd == -1) throwError("Error opening shared memory");
-    ftruncate(shm_fd, SHM_SIZE);
-    rbcData_t *rbcData = (rbcData_t*)mmap(0, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if(rbcData == MAP_FAILED) throwError("Error mapping shared memory");
-    rbcDataInit(rbcData);
-    unlink(RBC_LOG); // Remove RBC log file if it exists
-    const int server_fd = rbcServerSocket();  // Create server socket
-
-    // Server function for the RBC process.
+// Fork server: a child process is created for each TRENO session.
+// rbcData is mapped shared, the children inherit the mapping and update the same tables.
+// The server waits on the server socket and on the signals of the RBC: the children are reaped as their sessions
+// end, and a stop request ends the RBC between two sessions.
+void rbcServeFork(const int server_fd, const int signal_fd, rbcData_t *rbcData) {
+    struct pollfd fds[2] = { { .fd = server_fd, .events = POLLIN }, { .fd = signal_fd, .events = POLLIN } };
     while (true) {
         // Client address
         struct sockaddr_un client_addr;
@@ -199,28 +206,271 @@ int main(void) {
         pid_t pid;
         // RBC waits for requests from TRENO processes
         printf("RBC Server waiting for TRENO requests.\n");
+        while (poll(fds, 2, -1) == -1) {
+            if (errno != EINTR) throwError("Error waiting for TRENO requests");
+        }
+        if ((fds[1].revents & POLLIN) && superviseSignal()) rbcShutdown();
+        if (!(fds[0].revents & POLLIN)) continue;
         switch (client_fd = accept(server_fd, client_addr_ptr, &client_len)) {
             case -1:
+                if(errno == EINTR) break;
                 throwError("Error accepting TRENO request");
                 break;
-            default:
-                // TRENO is appointed a child process of RBC when a request is taken
+            default: {
+                const uint64_t acceptStart = statsStart();
+                // TRENO is appointed a child process of RBC when its session is opened
                 switch (pid = fork()) {
                     case -1:
                         throwError("Error creating child process");
                         break;
                     case 0:
-                        // Child process handles request
+                        // Child process handles the session, it stops with the RBC so that a restarted RBC is the
+                        // only one writing the RBC data
+                        prctl(PR_SET_PDEATHSIG, SIGKILL);
+                        if (getppid() == 1) exit(EXIT_FAILURE);
+                        superviseChild();
                         close(server_fd);
-                        requestS(client_fd);
+                        requestS(client_fd, rbcData);
                         break;
                     default:
                         // Parent process closes client file descriptor
                         close(client_fd);
+                        statsSession(true);
+                        statsStage(STATS_ACCEPT, acceptStart);
                         break;
                 }
                 break;
+            }
+        }
+    }
+}
+
+// Sends the replies pending on a session as far as the socket takes them, without blocking. The session is
+// watched for EPOLLOUT while some are left.
+// Returns: false if the session failed
+static bool connFlush(rbcConn_t *conn) {
+    size_t sent = 0;
+    while(sent < conn->outLen) {
+        const ssize_t n = send(conn->fd, conn->out + sent, conn->outLen - sent, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("Failed to send authorization to TRENO");
+            return false;
+        }
+        sent += n;
+    }
+    conn->outLen -= sent;
+    memmove(conn->out, conn->out + sent, conn->outLen);
+    const bool watch = conn->outLen > 0;
+    if(watch != conn->outWatched) {
+        struct epoll_event event = { .events = EPOLLIN | (watch ? EPOLLOUT : 0), .data.ptr = conn };
+        if(epoll_ctl(serveEpollFd, EPOLL_CTL_MOD, conn->fd, &event) == -1) throwError("Failed to watch TRENO socket");
+        conn->outWatched = watch;
+    }
+    return true;
+}
+
+// Sends a reply to a session, after the replies still pending on it
+// Returns: false if the session failed
+static bool connSend(rbcConn_t *conn, const rbcReply_t *reply) {
+    if(conn->outLen + sizeof(*reply) > conn->outCap) {
+        conn->outCap = conn->outCap ? conn->outCap * 2 : RBC_MAX_PENDING * sizeof(*reply);
+        conn->out = (char *)realloc(conn->out, conn->outCap);
+        if(!conn->out) throwError("Failed to allocate TRENO connection");
+    }
+    memcpy(conn->out + conn->outLen, reply, sizeof(*reply));
+    conn->outLen += sizeof(*reply);
+    return connFlush(conn);
+}
+
+// Parks a queued request of a session until it is decided
+static void parkedAdd(const rbcConn_t *conn, const rbcRequest_t *request) {
+    if(nParked == parkedCapacity) {
+        parkedCapacity = parkedCapacity ? parkedCapacity * 2 : 16;
+        parked = (rbcParked_t *)realloc(parked, parkedCapacity * sizeof(rbcParked_t));
+        if(!parked) throwError("Failed to allocate parked requests");
+    }
+    parked[nParked].conn = (rbcConn_t *)conn;
+    parked[nParked].request = *request;
+    nParked++;
+}
+
+// Drops the parked requests of a session being closed, their trains leave the queues
+static void parkedDrop(rbcData_t *rbcData, const rbcConn_t *conn) {
+    for(int i = 0; i < nParked; ) {
+        if(parked[i].conn != conn) {
+            i++;
+            continue;
+        }
+        rbcQueueLeave(rbcData, parked[i].request.trainNum);
+        parked[i] = parked[--nParked];
+    }
+}
+
+// Closes a session, its parked requests are dropped
+static void connClose(rbcData_t *rbcData, rbcConn_t *conn) {
+    parkedDrop(rbcData, conn);
+    // Closing the socket also removes it from the epoll set
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+    statsSession(false);
+}
+
+// Decides again on the parked requests once a segment was freed, and pushes the decisions to their sessions.
+// The decisions free segments in turn: the requests are checked again until no segment is freed.
+// A session the decision cannot be pushed to is closed: its TRENO is gone.
+static void parkedRetry(rbcData_t *rbcData) {
+    uint32_t wake;
+    while(nParked > 0 && (wake = atomic_load(&rbcData->queues.wake)) != parkedWake) {
+        parkedWake = wake;
+        for(int i = 0; i < nParked; ) {
+            rbcReply_t reply;
+            if(!rbcQueueRetry(rbcData, &parked[i].request, &reply)) {
+                i++;
+                continue;
+            }
+            rbcConn_t *conn = parked[i].conn;
+            parked[i] = parked[--nParked];
+            if(!connSend(conn, &reply)) {
+                rbcQueueLeave(rbcData, reply.trainNum);
+                connClose(rbcData, conn);
+                // The parked requests of the session were dropped
+                i = 0;
+            }
+        }
+    }
+}
+
+// Reads the requests available on a ready TRENO session, decides on each of them in place and sends back the authorizations.
+// Frames may arrive split across reads, the partial frame is kept in the connection buffer.
+// Returns false when the TRENO closed its session or it failed.
+bool rbcServeClient(rbcData_t *rbcData, rbcConn_t *conn) {
+    while (true) {
+        const ssize_t received = recv(conn->fd, (char *)&conn->request + conn->len, sizeof(conn->request) - conn->len, 0);
+        if(received == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if(errno == EINTR) continue;
+            perror("Failed to receive message from TRENO");
+            return false;
+        }
+        if(received == 0) return false;
+        conn->len += received;
+        if(conn->len < sizeof(conn->request)) continue;
+        conn->len = 0;
+        // Segments left inside a movement authority are not answered
+        if(conn->request.type == RBC_MSG_RELEASE) {
+            rbcHandleRelease(rbcData, 0, &conn->request);
+            continue;
         }
+        // RBC decides if TRENO can advance
+        const rbcReply_t reply = rbcHandleRequest(rbcData, &conn->request);
+        // RBC sends authorization to TRENO, or keeps it until the socket takes it
+        if(!connSend(conn, &reply)) return false;
+        if(reply.status == RBC_QUEUED) parkedAdd(conn, &conn->request);
+    }
+}
+
+// Event-driven server: every TRENO session is handled by this single long-lived process.
+// The server socket, the client sockets and the signals of the RBC are multiplexed with epoll and rbcData is mapped only once.
+void rbcServeEpoll(const int server_fd, const int signal_fd, rbcData_t *rbcData) {
+    // Accept connections without blocking the event loop
+    if(fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK) == -1) throwError("Failed to set server socket non-blocking");
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1) throwError("Failed to create epoll instance");
+    serveEpollFd = epoll_fd;
+    // The server socket is the only event without a connection
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1) throwError("Failed to watch server socket");
+    struct epoll_event signalEvent = { .events = EPOLLIN, .data.ptr = RBC_SIGNAL_EVENT };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signalEvent) == -1) throwError("Failed to watch signal descriptor");
+    struct epoll_event events[RBC_MAX_EVENTS];
+    printf("RBC Server waiting for TRENO requests.\n");
+    while (true) {
+        const int nEvents = epoll_wait(epoll_fd, events, RBC_MAX_EVENTS, -1);
+        if(nEvents == -1) {
+            if(errno == EINTR) continue;
+            throwError("Error waiting for TRENO requests");
+        }
+        for(int i = 0; i < nEvents; i++) {
+            // The queue depth counts the ready sessions not served yet
+            statsQueueSet(nEvents - i);
+            rbcConn_t *conn = (rbcConn_t *)events[i].data.ptr;
+            if(conn == RBC_SIGNAL_EVENT) {
+                if(superviseSignal()) rbcShutdown();
+            }
+            else if(!conn) {
+                // Accept every pending connection
+                int client_fd;
+                uint64_t acceptStart = statsStart();
+                while((client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                    rbcConn_t *newConn = (rbcConn_t *)calloc(1, sizeof(rbcConn_t));
+                    if(!newConn) throwError("Failed to allocate TRENO connection");
+                    newConn->fd = client_fd;
+                    struct epoll_event clientEvent = { .events = EPOLLIN, .data.ptr = newConn };
+                    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &clientEvent) == -1) throwError("Failed to watch TRENO socket");
+                    statsSession(true);
+                    statsStage(STATS_ACCEPT, acceptStart);
+                    acceptStart = statsStart();
+                }
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) throwError("Error accepting TRENO request");
+            }
+            else {
+                // The replies left by a full socket go first
+                bool open = !(events[i].events & EPOLLOUT) || connFlush(conn);
+                if(open && (events[i].events & ~EPOLLOUT)) open = rbcServeClient(rbcData, conn);
+                if(!open) connClose(rbcData, conn);
+            }
+        }
+        // The requests of the batch may have freed segments parked requests wait for
+        parkedRetry(rbcData);
+        statsQueueSet(0);
+    }
+}
+
+// RBC MAIN
+/* This is the main function of the RBC program. It loads the topology named by its first argument, creates a shared memory segment sized from it and a server socket, initializes the shared memory data structure, sets a signal handler removes the RBC log file if it exists, and runs the RBC server.
+ The optional arguments select the server mode: FORK (default) creates a process for each session, EPOLL serves every session from this process, SHARDED splits the segments between worker threads;
+ VIRTUAL makes the RBC log the simulated time of a virtual time run; and WARM restarts an RBC that stopped during the run from its checkpoint. */
+
+int main(int argc, char *argv[]) {
+    // SIGUSR2 from PADRE_TRENI, SIGTERM and SIGINT stop the RBC from its event loop, SIGCHLD reaps the fork children
+    const int signal_fd = superviseInit();
+    printf("RBC Execution initialized.\n");
+    if(argc < 2) throwError("RBC arguments invalid");
+    topologyLoad(argv[1]);
+    bool epollMode = false, shardedMode = false, warm = false;
+    for(int i = 2; i < argc; i++) {
+        if(!strcmp(argv[i], "EPOLL")) epollMode = true;
+        else if(!strcmp(argv[i], "WARM")) warm = true;
+        else if(!strcmp(argv[i], "SHARDED")) shardedMode = true;
+        else if(!strcmp(argv[i], "VIRTUAL")) clockUseVirtual(false);
+    }
+    const int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if(shm_fd == -1) throwError("Error opening shared memory");
+    // The fork and epoll servers have a single shard
+    const int nShards = shardedMode ? rbcShardCount(topology.nSegm) : 1;
+    const size_t shmSize = RBC_DATA_SIZE(topology.nStations, topology.nSegm, nShards, topology.nTrains);
+    if(ftruncate(shm_fd, shmSize) == -1) throwError("Error sizing shared memory");
+    rbcData_t *rbcData = (rbcData_t*)mmap(0, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if(rbcData == MAP_FAILED) throwError("Error mapping shared memory");
+    rbcData->nShards = nShards;
+    rbcDataInit(rbcData, warm);
+    if(!warm) rbcLogReset(); // Remove RBC log file if it exists, a restarted RBC goes on with it
+    statsCreate(topology.nSegm); // Counters and latency histograms read by rbcstat
+    if(warm) unlink(SERVER_NAME); // Left by the RBC that stopped
+    const int server_fd = rbcServerSocket();  // Create server socket
+
+    // Server function for the RBC process.
+    if(shardedMode) {
+        printf("RBC Sharded server mode.\n");
+        rbcServeSharded(server_fd, signal_fd, rbcData);
+    }
+    else if(epollMode) {
+        printf("RBC Event-driven server mode.\n");
+        rbcServeEpoll(server_fd, signal_fd, rbcData);
     }
+    else rbcServeFork(server_fd, signal_fd, rbcData);
     return EXIT_SUCCESS;
 }
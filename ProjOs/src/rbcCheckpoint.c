@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeO.h"
+#include "../include/includeR.h"
+
+// Checkpoint of the RBC state: the stations and segments of the RBC data, kept in a memory-mapped file
+// (RBC_CKPT_FILE) so that an RBC restarted during a run (WARM) resumes where the previous one stopped, without
+// REGISTRO and without setting every segment free.
+// Each decision changing the RBC data records its changes in a journal ring of the file, with one slot taken by
+// an atomic add and written in place: a few stores on the request path, no system call, the page cache keeps
+// them when the RBC process dies. When the ring is half full the writer that notices it folds the journal into
+// the snapshot of the nodes. Recovery folds what is left and loads the snapshot into the RBC data.
+// The slot of a change is taken after a segment is taken and before it is freed, so that the journal orders
+// the changes of a segment as the RBC made them. A change whose slot was taken but not written when the RBC
+// died is lost: a segment taken is then free again, its train never got the reply; a segment freed stays held.
+// Each snapshot node keeps the last slot applied to it, so that folding an entry twice changes nothing.
+// The snapshot also keeps the last move granted to each train by a request: after a warm restart a request sent
+// again for that move is answered granted without any change (rbcCheckpointReplay), its reply was lost.
+// The file follows the RBC process, not the machine: nothing is synced to disk.
+
+static rbcCkptHeader_t *ckpt = NULL;
+static rbcCkptNode_t *ckptNodes = NULL;
+static rbcCkptMove_t *ckptMoves = NULL;
+static rbcJournalEntry_t *journal = NULL;
+static size_t ckptSize = 0;
+// Last moves granted by the previous RBC, loaded by a warm restart
+static rbcCkptMove_t *replayMoves = NULL;
+static int nReplayMoves = 0;
+
+// Layout of the checkpoint file of a topology, with mapLength bytes of itineraries
+static size_t ckptJournalOffset(const int nNodes, const int nTrains) {
+    const size_t end = sizeof(rbcCkptHeader_t) + nNodes * sizeof(rbcCkptNode_t) + nTrains * sizeof(rbcCkptMove_t);
+    return (end + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+static size_t ckptMapOffset(const int nNodes, const int nTrains) {
+    return ckptJournalOffset(nNodes, nTrains) + RBC_JOURNAL_SIZE * sizeof(rbcJournalEntry_t);
+}
+
+static void ckptMap(const int fd, const size_t size, const int nNodes) {
+    ckpt = (rbcCkptHeader_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ckpt == MAP_FAILED) throwError("Error mapping RBC checkpoint");
+    ckptSize = size;
+    ckptNodes = (rbcCkptNode_t *)(ckpt + 1);
+    ckptMoves = (rbcCkptMove_t *)(ckptNodes + nNodes);
+}
+
+// Snapshot node of a station or a segment
+static rbcCkptNode_t *ckptNode(const int32_t node) {
+    return NODE_IS_STATION(node) ? &ckptNodes[NODE_NUM(node) - 1] : &ckptNodes[ckpt->nStations + NODE_NUM(node) - 1];
+}
+
+// Applies a journal entry to the snapshot, unless it was already
+static void journalApply(const rbcJournalEntry_t *entry, const uint64_t slot) {
+    for(int k = 0; k < 2; k++) {
+        if(entry->node[k] == NODE_NONE) continue;
+        rbcCkptNode_t *node = ckptNode(entry->node[k]);
+        if(node->seq > slot) continue;
+        node->value = NODE_IS_STATION(entry->node[k]) ? node->value + entry->value[k] : entry->value[k];
+        node->seq = slot + 1;
+    }
+    if(entry->trainNum <= 0 || entry->trainNum > ckpt->nTrains) return;
+    rbcCkptMove_t *move = &ckptMoves[entry->trainNum - 1];
+    if(move->seq > slot) return;
+    move->currNode = entry->currNode;
+    move->nextNode = entry->node[0];
+    move->seq = slot + 1;
+}
+
+// Folds the journal slots before limit into the snapshot, in order. Live, a slot taken and not written yet is
+// waited for: its writer is between two stores. On recovery it never will be, and is skipped.
+static void journalFold(const uint64_t limit, const bool recovering) {
+    uint64_t slot = atomic_load_explicit(&ckpt->folded, memory_order_relaxed);
+    for(; slot < limit; slot++) {
+        const rbcJournalEntry_t *entry = &journal[slot & (RBC_JOURNAL_SIZE - 1)];
+        while(atomic_load_explicit(&entry->seq, memory_order_acquire) != slot + 1) {
+            if(recovering) break;
+            sched_yield();
+        }
+        if(atomic_load_explicit(&entry->seq, memory_order_relaxed) == slot + 1) journalApply(entry, slot);
+        atomic_store_explicit(&ckpt->folded, slot + 1, memory_order_release);
+    }
+}
+
+// Folds the journal up to limit, unless another writer is folding it
+static void journalTryFold(const uint64_t limit) {
+    int32_t unlocked = 0;
+    if(!atomic_compare_exchange_strong_explicit(&ckpt->foldLock, &unlocked, 1, memory_order_acquire, memory_order_relaxed)) return;
+    journalFold(limit, false);
+    atomic_store_explicit(&ckpt->foldLock, 0, memory_order_release);
+}
+
+// rbcJournalReserve takes the journal slot of the next change, written by rbcJournalCommit.
+// A segment is freed after its slot is taken, and taken before.
+// Returns: the slot, 0 when the process keeps no checkpoint (the benchmarks)
+uint64_t rbcJournalReserve() {
+    if(!ckpt) return 0;
+    const uint64_t slot = atomic_fetch_add_explicit(&ckpt->head, 1, memory_order_relaxed);
+    if(slot - atomic_load_explicit(&ckpt->folded, memory_order_acquire) >= RBC_JOURNAL_SIZE / 2) journalTryFold(slot);
+    // The slot is still used by an entry that is not folded yet
+    while(slot - atomic_load_explicit(&ckpt->folded, memory_order_acquire) >= RBC_JOURNAL_SIZE) {
+        journalTryFold(slot);
+        sched_yield();
+    }
+    return slot;
+}
+
+// rbcJournalGrant writes the changes made under a slot taken by rbcJournalReserve by the request of a train
+// granted the move currNode -> nodeA, NODE_NONE for no change
+void rbcJournalGrant(const uint64_t slot, const int trainNum, const int32_t currNode, const int32_t nodeA, const int32_t valueA,
+        const int32_t nodeB, const int32_t valueB) {
+    if(!ckpt) return;
+    rbcJournalEntry_t *entry = &journal[slot & (RBC_JOURNAL_SIZE - 1)];
+    entry->node[0] = nodeA;
+    entry->value[0] = valueA;
+    entry->node[1] = nodeB;
+    entry->value[1] = valueB;
+    entry->trainNum = trainNum;
+    entry->currNode = currNode;
+    atomic_store_explicit(&entry->seq, slot + 1, memory_order_release);
+}
+
+// rbcJournalCommit writes the changes made under a slot taken by rbcJournalReserve, NODE_NONE for no change
+void rbcJournalCommit(const uint64_t slot, const int32_t nodeA, const int32_t valueA, const int32_t nodeB, const int32_t valueB) {
+    rbcJournalGrant(slot, 0, NODE_NONE, nodeA, valueA, nodeB, valueB);
+}
+
+// rbcJournal records changes already made, none of them freeing a segment
+void rbcJournal(const int32_t nodeA, const int32_t valueA, const int32_t nodeB, const int32_t valueB) {
+    if(!ckpt) return;
+    rbcJournalCommit(rbcJournalReserve(), nodeA, valueA, nodeB, valueB);
+}
+
+// rbcCheckpointCreate starts the checkpoint of a new run from the initialized RBC data and the map of REGISTRO,
+// replacing the one of a previous run
+void rbcCheckpointCreate(const rbcData_t *rbcData, char **paths) {
+    const int nNodes = rbcData->nStations + rbcData->nSegm;
+    size_t mapLength = 0;
+    for(int i = 0; i < rbcData->nTrains; i++) mapLength += strlen(paths[i]) + 1;
+    const size_t journalOffset = ckptJournalOffset(nNodes, rbcData->nTrains);
+    const size_t mapOffset = ckptMapOffset(nNodes, rbcData->nTrains);
+    const int fd = open(RBC_CKPT_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if(fd == -1) throwError("Error creating RBC checkpoint");
+    // ftruncate zeroes the file: the journal is empty
+    if(ftruncate(fd, mapOffset + mapLength) == -1) throwError("Error sizing RBC checkpoint");
+    ckptMap(fd, mapOffset + mapLength, nNodes);
+    close(fd);
+    journal = (rbcJournalEntry_t *)((char *)ckpt + journalOffset);
+    ckpt->version = RBC_CKPT_VERSION;
+    ckpt->nStations = rbcData->nStations;
+    ckpt->nSegm = rbcData->nSegm;
+    ckpt->nTrains = rbcData->nTrains;
+    ckpt->firstPid = ckpt->pid = getpid();
+    ckpt->journalOffset = journalOffset;
+    ckpt->mapOffset = mapOffset;
+    ckpt->mapLength = mapLength;
+    for(int i = 0; i < nNodes; i++) ckptNodes[i].value = atomic_load(&rbcData->nodes[i].value);
+    for(int i = 0; i < rbcData->nTrains; i++) ckptMoves[i].currNode = ckptMoves[i].nextNode = NODE_NONE;
+    char *map = (char *)ckpt + ckpt->mapOffset;
+    for(int i = 0; i < rbcData->nTrains; i++) {
+        strcpy(map, paths[i]);
+        map += strlen(paths[i]) + 1;
+    }
+    // A checkpoint torn by a crash during its creation has no magic
+    atomic_thread_fence(memory_order_release);
+    ckpt->magic = RBC_CKPT_MAGIC;
+}
+
+// Stops a warm restart on a checkpoint it cannot use
+static void ckptError(const char *msg) {
+    errno = EINVAL;
+    throwError(msg);
+}
+
+// rbcCheckpointRecover restarts the RBC from the checkpoint left by the previous RBC of the run: the journal
+// is folded into the snapshot, which is loaded into the RBC data.
+// Returns: the itineraries of the map, one per train, allocated with malloc
+char **rbcCheckpointRecover(rbcData_t *rbcData) {
+    const int fd = open(RBC_CKPT_FILE, O_RDWR);
+    if(fd == -1) throwError("No RBC checkpoint to restart from");
+    struct stat fs;
+    if(fstat(fd, &fs) == -1) throwError("Error reading RBC checkpoint");
+    if((size_t)fs.st_size < sizeof(rbcCkptHeader_t)) ckptError("Invalid RBC checkpoint");
+    const int nNodes = rbcData->nStations + rbcData->nSegm;
+    ckptMap(fd, fs.st_size, nNodes);
+    close(fd);
+    if(ckpt->magic != RBC_CKPT_MAGIC || ckpt->version != RBC_CKPT_VERSION
+            || ckpt->journalOffset != ckptJournalOffset(nNodes, rbcData->nTrains)
+            || ckpt->mapOffset != ckptMapOffset(nNodes, rbcData->nTrains) || ckpt->mapOffset + ckpt->mapLength > ckptSize) {
+        ckptError("Invalid RBC checkpoint");
+    }
+    if(ckpt->nStations != rbcData->nStations || ckpt->nSegm != rbcData->nSegm || ckpt->nTrains != rbcData->nTrains) {
+        ckptError("RBC checkpoint does not match the topology");
+    }
+    journal = (rbcJournalEntry_t *)((char *)ckpt + ckpt->journalOffset);
+    // No other process writes the journal any more
+    const uint64_t head = atomic_load(&ckpt->head);
+    journalFold(head, true);
+    atomic_store(&ckpt->foldLock, 0);
+    for(int i = 0; i < nNodes; i++) atomic_store(&rbcData->nodes[i].value, ckptNodes[i].value);
+    // The moves granted from now on are not replays
+    replayMoves = (rbcCkptMove_t *)malloc(rbcData->nTrains * sizeof(rbcCkptMove_t));
+    if(!replayMoves) throwError("Failed to allocate RBC checkpoint");
+    memcpy(replayMoves, ckptMoves, rbcData->nTrains * sizeof(rbcCkptMove_t));
+    nReplayMoves = rbcData->nTrains;
+    ckpt->pid = getpid();
+    char **paths = (char **)calloc(rbcData->nTrains, sizeof(char *));
+    if(!paths) throwError("Failed to allocate RBC paths");
+    const char *map = (const char *)ckpt + ckpt->mapOffset, *mapEnd = map + ckpt->mapLength;
+    for(int i = 0; i < rbcData->nTrains; i++) {
+        const size_t length = strnlen(map, mapEnd - map);
+        if(map + length == mapEnd) ckptError("Invalid RBC checkpoint");
+        paths[i] = strdup(map);
+        if(!paths[i]) throwError("Failed to allocate RBC paths");
+        map += length + 1;
+    }
+    return paths;
+}
+
+// rbcCheckpointReplay returns true if the move currNode -> nextNode of a train is the last one granted to it by the
+// RBC the checkpoint was recovered from: the train sends the request again as it never got the reply
+bool rbcCheckpointReplay(const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    if(trainNum <= 0 || trainNum > nReplayMoves) return false;
+    return replayMoves[trainNum - 1].currNode == currNode && replayMoves[trainNum - 1].nextNode == nextNode;
+}
+
+// rbcCheckpointCheck cross-checks the recovered RBC data against the occupancy table of the trains.
+// A segment held in the RBC data may still be free in the occupancy table, its train has not entered it yet.
+// Returns: the segments occupied by a train that the RBC data holds for none, they are denied until freed
+int rbcCheckpointCheck(const rbcData_t *rbcData) {
+    int mismatches = 0;
+    for(int s = 1; s <= rbcData->nSegm; s++) {
+        if(atomic_load(&RBC_SEGM(rbcData, s)->value) == 0 && !isSegmentFree(s)) mismatches++;
+    }
+    return mismatches;
+}
+
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/includeF.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeK.h"
+
+// Deadlocks between trains. Two itineraries crossing the same segments in opposite directions can leave their
+// trains facing each other, each asking for the segment the other holds, forever.
+// The RBC keeps a wait-for graph in the RBC data: a train denied a segment waits for the train holding it, until
+// one of its requests is granted. A train waits for a single train at a time, so an edge closes a cycle exactly
+// when the edges followed from the holder lead back to the train that asked. An edge also names the segment the
+// awaited train holds: the edge of a train that did not ask again since it was denied is only trusted while that
+// train still holds the segment, so a wait that ended is never taken for a deadlock.
+// The policy is RAIL_DEADLOCK_POLICY:
+//   - hold (default): a train waits out of a single-track section while an opposing train is in it (see
+//     rbcHeadOnBlocked), so that head-on cycles do not form; the cycles left are broken as with priority
+//   - priority: the train of lowest priority of the cycle, the highest train number, is withdrawn: its next
+//     request, or its request waiting in a queue, frees every segment it holds and is answered
+//     RBC_DENIED_WITHDRAWN, the train leaves the line
+//   - detect: the cycles are only reported
+//   - off: no wait-for graph, as before the RBC handled deadlocks
+
+// Frees a segment owned by another shard for rbcWithdraw, NULL when one shard writes every segment
+static void (*withdrawHook)(const int shard, const int owner, const int trainNum, const int segmNum) = NULL;
+
+// deadlockPolicy returns the policy of the RBC, read once from the environment
+deadlockPolicy_t deadlockPolicy() {
+    static int policy = -1;
+    if(policy == -1) {
+        const char *env = getenv(DEADLOCK_POLICY_ENV);
+        if(env && !strcmp(env, "priority")) policy = DEADLOCK_PRIORITY;
+        else if(env && !strcmp(env, "detect")) policy = DEADLOCK_DETECT;
+        else if(env && !strcmp(env, "off")) policy = DEADLOCK_OFF;
+        else policy = DEADLOCK_HOLD;
+    }
+    return (deadlockPolicy_t)policy;
+}
+
+// Prints a confirmed cycle, from the train that closed it
+static void deadlockReport(const rbcData_t *rbcData, const int trainNum, const int victim) {
+    char cycle[256];
+    int len = snprintf(cycle, sizeof(cycle), "TRENO %d", trainNum);
+    int32_t t = WAIT_HOLDER(atomic_load(&RBC_WAIT(rbcData, trainNum)->edge));
+    for(int hops = 0; hops < rbcData->nTrains && t > 0 && len < (int)sizeof(cycle); hops++) {
+        len += snprintf(cycle + len, sizeof(cycle) - len, " -> TRENO %d", t);
+        if(t == trainNum) break;
+        t = WAIT_HOLDER(atomic_load(&RBC_WAIT(rbcData, t)->edge));
+    }
+    if(victim) printf("RBC Deadlock: %s, TRENO %d withdrawn.\n", cycle, victim);
+    else printf("RBC Deadlock: %s.\n", cycle);
+    // A run left deadlocked is usually killed, the report must not stay in the buffer
+    fflush(stdout);
+}
+
+// Follows the wait-for edges from the train holder, every edge still backed by its segment.
+// Returns: true if they lead back to trainNum, victim is then set to the highest train number of the cycle
+static bool waitCycle(const rbcData_t *rbcData, const int trainNum, const int32_t holder, int32_t *victim) {
+    int32_t t = holder;
+    *victim = trainNum;
+    for(int hops = 0; hops < rbcData->nTrains && t != trainNum; hops++) {
+        const uint64_t edge = atomic_load(&RBC_WAIT(rbcData, t)->edge);
+        if(edge == 0 || atomic_load(&RBC_SEGM(rbcData, WAIT_SEGM(edge))->value) != WAIT_HOLDER(edge)) return false;
+        if(t > *victim) *victim = t;
+        t = WAIT_HOLDER(edge);
+    }
+    return t == trainNum;
+}
+
+// rbcWaitUpdate records the decision on a request of a train in the wait-for graph: a train denied a segment
+// held by another train waits for it, any other decision ends its wait. A new edge is checked for a cycle.
+// Parameters:
+//   - holder: the train holding the segment asked for, or the opposing train holding the train out of a section
+//   - segm: the segment holder holds
+void rbcWaitUpdate(rbcData_t *rbcData, const int trainNum, const rbcStatus_t status, const int32_t holder, const int segm) {
+    if(trainNum <= 0 || trainNum > rbcData->nTrains || deadlockPolicy() == DEADLOCK_OFF) return;
+    rbcWait_t *wait = RBC_WAIT(rbcData, trainNum);
+    const uint64_t edge = atomic_load_explicit(&wait->edge, memory_order_relaxed);
+    if(status != RBC_DENIED_OCCUPIED || holder <= 0 || holder > rbcData->nTrains || holder == trainNum) {
+        // The line of the train is only written when it was waiting
+        if(edge != 0) atomic_store_explicit(&wait->edge, 0, memory_order_release);
+        return;
+    }
+    const uint64_t newEdge = WAIT_EDGE(holder, segm);
+    if(edge != newEdge) atomic_store(&wait->edge, newEdge);
+    // Followed twice, so that a cycle is only seen if no train of it moved in between
+    int32_t victim, again;
+    if(!waitCycle(rbcData, trainNum, holder, &victim) || !waitCycle(rbcData, trainNum, holder, &again)) return;
+    if(deadlockPolicy() == DEADLOCK_DETECT) {
+        // Reported by the train that closed it, its later requests find the same edge
+        if(edge != newEdge) {
+            statsDeadlock();
+            deadlockReport(rbcData, trainNum, 0);
+        }
+        return;
+    }
+    // The trains of the cycle may find it concurrently, only one withdraws the victim
+    int32_t withdrawn = 0;
+    if(!atomic_compare_exchange_strong(&RBC_WAIT(rbcData, victim)->withdrawn, &withdrawn, 1)) return;
+    statsDeadlock();
+    deadlockReport(rbcData, trainNum, victim);
+    // The victim may wait in a queue: its parked request is answered at once
+    rbcQueueNotify(rbcData);
+}
+
+// rbcWithdrawPending returns true if the train was withdrawn and has not been told yet
+bool rbcWithdrawPending(const rbcData_t *rbcData, const int trainNum) {
+    return atomic_load_explicit(&RBC_WAIT(rbcData, trainNum)->withdrawn, memory_order_acquire) != 0;
+}
+
+// rbcWithdraw takes a withdrawn train off the line: every segment it holds is freed, and its wait ends.
+// The segments owned by another shard are freed by its worker, through the hook set by rbcWithdrawSetHook.
+// The train, answered RBC_DENIED_WITHDRAWN, frees its position in the occupancy table and ends its run.
+void rbcWithdraw(rbcData_t *rbcData, const int shard, const int trainNum) {
+    rbcWriteBegin(rbcData, shard);
+    for(int s = 1; s <= rbcData->nSegm; s++) {
+        if(atomic_load(&RBC_SEGM(rbcData, s)->value) != trainNum) continue;
+        if(withdrawHook && RBC_SEGM_SHARD(rbcData, s) != shard) {
+            withdrawHook(shard, RBC_SEGM_SHARD(rbcData, s), trainNum, s);
+            continue;
+        }
+        int32_t holder = trainNum;
+        const uint64_t slot = rbcJournalReserve();
+        const bool released = atomic_compare_exchange_strong(&RBC_SEGM(rbcData, s)->value, &holder, 0);
+        rbcJournalCommit(slot, released ? NODE_SEGM(s) : NODE_NONE, 0, NODE_NONE, 0);
+    }
+    rbcWriteEnd(rbcData, shard, true);
+    atomic_store(&RBC_WAIT(rbcData, trainNum)->edge, 0);
+    atomic_store(&RBC_WAIT(rbcData, trainNum)->withdrawn, 0);
+    rbcQueueLeave(rbcData, trainNum);
+    rbcQueueNotify(rbcData);
+    printf("RBC TRENO %d withdrawn from the line.\n", trainNum);
+}
+
+// rbcWithdrawSetHook registers the function rbcWithdraw calls, from the worker of shard, to free a segment that
+// only the worker of owner writes (the sharded server)
+void rbcWithdrawSetHook(void (*hook)(const int shard, const int owner, const int trainNum, const int segmNum)) {
+    withdrawHook = hook;
+}
@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+
+#include "../include/includeF.h"
+#include "../include/includeL.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeK.h"
+#include "../include/includeT.h"
+
+// RBC decision logic, shared by the server modes of the RBC and by the benchmarks.
+// It works on the RBC data and the occupancy table only, without sockets or processes.
+// The parse, decide and log stages are timed in the RBC statistics, when the process records them.
+// Requests are decided concurrently (fork mode children share the RBC data): a segment is taken with a
+// compare-and-swap of its holder, so that of two trains asking for the same segment only one gets it.
+
+// Itineraries of the trains, compiled by rbcRoutesInit: movement authorities extend along them
+static route_t *rbcRoutes = NULL;
+static int rbcNRoutes = 0;
+// Conflict index, built from the itineraries by rbcRoutesInit: the itineraries crossing each segment,
+// and every pair of itineraries sharing a segment with the direction they cross it in
+typedef struct segmUse_t {
+    int32_t nTrains;        // crossings of the segment by the itineraries
+    int32_t train;          // the itinerary of the first crossing
+    int32_t pos;            // index of the segment in its route
+} segmUse_t;
+static segmUse_t *rbcSegmUse = NULL;
+static int rbcNSegmUse = 0;
+static rbcConflict_t *rbcConflictList = NULL;
+static int rbcNConflicts = 0;
+// For each node of each route, whether it is a segment the route shares head-on with another one
+static bool **rbcHeadOn = NULL;
+
+// Returns true if the segment has the correct status in the `rbcData` data structure, false otherwise.
+bool segmStatusChecker(rbcData_t *rbcData, const int32_t node) {
+    // If this is a station, return true
+    if (NODE_IS_STATION(node)) return true; 
+    // Get the value of the segment's status in the occupancy table
+    const bool segmentFileValue = !isSegmentFree(NODE_NUM(node));
+    // Get the value of the segment's status in the RBC data
+    const bool rbcSegmentFileValue = atomic_load_explicit(&RBC_SEGM(rbcData, NODE_NUM(node))->value, memory_order_acquire) != 0;
+    // Return true if the values match, false otherwise
+    return segmentFileValue == rbcSegmentFileValue;
+}
+
+// Returns true if the node identifies an existing station or segment of the topology
+bool nodeValid(const rbcData_t *rbcData, const int32_t node) {
+    if (node == NODE_NONE) return false;
+    if (NODE_IS_STATION(node)) return NODE_NUM(node) <= rbcData->nStations;
+    return NODE_NUM(node) <= rbcData->nSegm;
+}
+
+
+// rbcWriteBegin opens a change of the RBC data by a shard: snapshot readers retry while a change is running
+void rbcWriteBegin(rbcData_t *rbcData, const int shard) {
+    atomic_fetch_add(RBC_SEQ(rbcData, shard), 1);
+    // The changes that follow are not visible before the writer count
+    atomic_thread_fence(memory_order_release);
+}
+
+// rbcWriteEnd closes a change of the RBC data: the writer leaves and, when the data changed, the version is bumped
+void rbcWriteEnd(rbcData_t *rbcData, const int shard, const bool changed) {
+    atomic_fetch_add_explicit(RBC_SEQ(rbcData, shard), changed ? (1ULL << 32) - 1 : (uint64_t)-1, memory_order_release);
+}
+
+// rbcDataSnapshot copies the state of every node at a single point in time, while trains keep moving.
+// The copy is consistent within each shard, a train handed over between two shards may be seen in both.
+// Parameters:
+//   - stations: nStations entries, the trains in each station
+//   - segms: nSegm entries, the train holding each segment, 0 when free
+// Returns: the version of the RBC data the snapshot was taken at, the sum of the versions of the shards
+uint32_t rbcDataSnapshot(const rbcData_t *rbcData, int32_t *stations, int32_t *segms) {
+    uint64_t seqs[RBC_MAX_SHARDS];
+    const int nShards = rbcData->nShards < RBC_MAX_SHARDS ? rbcData->nShards : RBC_MAX_SHARDS;
+    while(true) {
+        bool writing = false;
+        for(int s = 0; s < nShards; s++) {
+            seqs[s] = atomic_load_explicit(RBC_SEQ(rbcData, s), memory_order_acquire);
+            writing = writing || RBC_SEQ_WRITERS(seqs[s]) != 0;
+        }
+        if(writing) {
+            sched_yield();
+            continue;
+        }
+        for(int i = 0; i < rbcData->nStations; i++) {
+            stations[i] = atomic_load_explicit(&RBC_STATION(rbcData, i + 1)->value, memory_order_relaxed);
+        }
+        for(int i = 0; i < rbcData->nSegm; i++) {
+            segms[i] = atomic_load_explicit(&RBC_SEGM(rbcData, i + 1)->value, memory_order_relaxed);
+        }
+        // A change seen by the copy makes its writer or its new version visible here
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t version = 0;
+        bool changed = false;
+        for(int s = 0; s < nShards && !changed; s++) {
+            changed = atomic_load_explicit(RBC_SEQ(rbcData, s), memory_order_relaxed) != seqs[s];
+            version += RBC_SEQ_VERSION(seqs[s]);
+        }
+        if(!changed) return version;
+    }
+}
+
+// rbcRequestValid returns true if a request frame has the expected version and type and names an existing
+// train and existing nodes
+bool rbcRequestValid(const rbcData_t *rbcData, const rbcRequest_t *request) {
+    return request->version == RBC_PROTO_VERSION
+            && (RBC_MSG_TYPE(request->type) == RBC_MSG_REQUEST || RBC_MSG_TYPE(request->type) == RBC_MSG_QUEUE)
+            && request->trainNum > 0 && request->trainNum <= rbcData->nTrains
+            && nodeValid(rbcData, request->currNode) && nodeValid(rbcData, request->nextNode);
+}
+
+
+// rbcRequestReplay returns true if a valid request frame was sent again on a session reconnected to the RBC
+// restarted from its checkpoint, for the last move the previous RBC granted to the train
+bool rbcRequestReplay(const rbcRequest_t *request) {
+    return (request->type & RBC_MSG_RESENT) && rbcCheckpointReplay(request->trainNum, request->currNode, request->nextNode);
+}
+
+// Direction in which two routes cross a segment, from the nodes before and after it in each route
+static conflictDir_t conflictDir(const route_t *a, const int posA, const route_t *b, const int posB) {
+    const int32_t fromA = posA > 0 ? a->nodes[posA - 1] : NODE_NONE;
+    const int32_t toA = posA + 1 < a->nNodes ? a->nodes[posA + 1] : NODE_NONE;
+    const int32_t fromB = posB > 0 ? b->nodes[posB - 1] : NODE_NONE;
+    const int32_t toB = posB + 1 < b->nNodes ? b->nodes[posB + 1] : NODE_NONE;
+    if(fromA == fromB && toA == toB) return CONFLICT_SAME;
+    // One route enters the segment where the other leaves it
+    if((fromA != NODE_NONE && fromA == toB) || (toA != NODE_NONE && toA == fromB)) return CONFLICT_OPPOSITE;
+    if(fromA == fromB || toA == toB) return CONFLICT_SAME;
+    return CONFLICT_CROSSING;
+}
+
+static void conflictAdd(const rbcConflict_t *conflict, int *capacity) {
+    if(rbcNConflicts == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        rbcConflictList = (rbcConflict_t *)realloc(rbcConflictList, *capacity * sizeof(rbcConflict_t));
+        if(!rbcConflictList) throwError("Failed to allocate RBC conflict index");
+    }
+    rbcConflictList[rbcNConflicts++] = *conflict;
+}
+
+// Returns true if the itineraries of two trains cross a segment in opposite directions
+static bool conflictHeadOn(const int trainA, const int trainB, const int segm) {
+    const int a = trainA < trainB ? trainA : trainB, b = trainA < trainB ? trainB : trainA;
+    for(int i = 0; i < rbcNConflicts; i++) {
+        const rbcConflict_t *conflict = &rbcConflictList[i];
+        if(conflict->segm == segm && conflict->trainA == a && conflict->trainB == b) return conflict->dir == CONFLICT_OPPOSITE;
+    }
+    return false;
+}
+
+// Marks the nodes of the routes shared head-on, the single-track sections rbcHeadOnBlocked guards
+static void headOnInit() {
+    rbcHeadOn = (bool **)calloc(rbcNRoutes, sizeof(bool *));
+    if(!rbcHeadOn) throwError("Failed to allocate RBC conflict index");
+    for(int t = 0; t < rbcNRoutes; t++) {
+        rbcHeadOn[t] = (bool *)calloc(rbcRoutes[t].nNodes + 1, sizeof(bool));
+        if(!rbcHeadOn[t]) throwError("Failed to allocate RBC conflict index");
+    }
+    for(int i = 0; i < rbcNConflicts; i++) {
+        const rbcConflict_t *conflict = &rbcConflictList[i];
+        if(conflict->dir != CONFLICT_OPPOSITE) continue;
+        const int trains[2] = { conflict->trainA, conflict->trainB };
+        for(int k = 0; k < 2; k++) {
+            const route_t *route = &rbcRoutes[trains[k] - 1];
+            for(int n = 0; n < route->nNodes; n++) {
+                if(route->nodes[n] == NODE_SEGM(conflict->segm)) rbcHeadOn[trains[k] - 1][n] = true;
+            }
+        }
+    }
+}
+
+// Builds the conflict index from the compiled routes. Each segment gets the list of its crossings
+// (train and index in the route), every two crossings by different trains make a conflict.
+static void conflictsInit(const int nSegm) {
+    rbcNSegmUse = nSegm;
+    rbcSegmUse = (segmUse_t *)calloc(nSegm, sizeof(segmUse_t));
+    int *first = (int *)calloc(nSegm + 1, sizeof(int));
+    if(!rbcSegmUse || !first) throwError("Failed to allocate RBC conflict index");
+    for(int t = 0; t < rbcNRoutes; t++) {
+        for(int i = 0; i < rbcRoutes[t].nNodes; i++) {
+            const int32_t node = rbcRoutes[t].nodes[i];
+            if(NODE_IS_STATION(node) || NODE_NUM(node) > nSegm) continue;
+            segmUse_t *use = &rbcSegmUse[NODE_NUM(node) - 1];
+            if(use->nTrains++ == 0) {
+                use->train = t + 1;
+                use->pos = i;
+            }
+        }
+    }
+    // Crossings of the shared segments, grouped by segment
+    for(int s = 0; s < nSegm; s++) first[s + 1] = first[s] + (rbcSegmUse[s].nTrains > 1 ? rbcSegmUse[s].nTrains : 0);
+    int32_t (*crossings)[2] = (int32_t (*)[2])calloc(first[nSegm] ? first[nSegm] : 1, sizeof(*crossings));
+    int *filled = (int *)calloc(nSegm, sizeof(int));
+    if(!crossings || !filled) throwError("Failed to allocate RBC conflict index");
+    for(int t = 0; t < rbcNRoutes; t++) {
+        for(int i = 0; i < rbcRoutes[t].nNodes; i++) {
+            const int32_t node = rbcRoutes[t].nodes[i];
+            if(NODE_IS_STATION(node) || NODE_NUM(node) > nSegm || rbcSegmUse[NODE_NUM(node) - 1].nTrains < 2) continue;
+            const int s = NODE_NUM(node) - 1;
+            crossings[first[s] + filled[s]][0] = t;
+            crossings[first[s] + filled[s]][1] = i;
+            filled[s]++;
+        }
+    }
+    int capacity = 0, shared = 0, opposite = 0;
+    for(int s = 0; s < nSegm; s++) {
+        if(first[s + 1] > first[s]) shared++;
+        for(int a = first[s]; a < first[s + 1]; a++) {
+            for(int b = a + 1; b < first[s + 1]; b++) {
+                // Crossings are filled in train order: trainA < trainB, and a loop of a single route is no conflict
+                if(crossings[a][0] == crossings[b][0]) continue;
+                const rbcConflict_t conflict = {
+                    .trainA = crossings[a][0] + 1,
+                    .trainB = crossings[b][0] + 1,
+                    .segm = s + 1,
+                    .dir = conflictDir(&rbcRoutes[crossings[a][0]], crossings[a][1], &rbcRoutes[crossings[b][0]], crossings[b][1])
+                };
+                if(conflict.dir == CONFLICT_OPPOSITE) opposite++;
+                conflictAdd(&conflict, &capacity);
+            }
+        }
+    }
+    free(crossings);
+    free(filled);
+    free(first);
+    headOnInit();
+    printf("RBC Conflict index: %d of %d segments shared, %d conflicts (%d head-on).\n", shared, nSegm, rbcNConflicts, opposite);
+}
+
+// rbcRoutesInit compiles the itineraries received from REGISTRO, one per train ("--" when the train has none),
+// and builds their conflict index over the nSegm segments of the topology
+void rbcRoutesInit(char **paths, const int nTrains, const int nSegm) {
+    rbcRoutes = (route_t *)calloc(nTrains, sizeof(route_t));
+    if(!rbcRoutes) throwError("Failed to allocate RBC routes");
+    for(int i = 0; i < nTrains; i++) rbcRoutes[i] = routeCompile(paths[i]);
+    rbcNRoutes = nTrains;
+    conflictsInit(nSegm);
+}
+
+// rbcSegmShared returns true if more than one itinerary crosses the segment, or if the itineraries are unknown
+bool rbcSegmShared(const int segmNum) {
+    if(!rbcSegmUse || segmNum <= 0 || segmNum > rbcNSegmUse) return true;
+    return rbcSegmUse[segmNum - 1].nTrains > 1;
+}
+
+// rbcMovePrivate returns true if the move currNode -> nextNode follows the itinerary of the train between two
+// segments that no other itinerary crosses: no other train following its itinerary ever contends for them.
+bool rbcMovePrivate(const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    if(!rbcSegmUse || NODE_IS_STATION(currNode) || NODE_IS_STATION(nextNode)) return false;
+    if(NODE_NUM(currNode) > rbcNSegmUse || NODE_NUM(nextNode) > rbcNSegmUse) return false;
+    const segmUse_t *curr = &rbcSegmUse[NODE_NUM(currNode) - 1];
+    const segmUse_t *next = &rbcSegmUse[NODE_NUM(nextNode) - 1];
+    return curr->nTrains == 1 && next->nTrains == 1 && curr->train == trainNum && next->train == trainNum
+            && next->pos == curr->pos + 1;
+}
+
+// rbcConflicts returns the conflict index: the pairs of itineraries sharing a segment, by segment
+const rbcConflict_t *rbcConflicts(int *nConflicts) {
+    *nConflicts = rbcNConflicts;
+    return rbcConflictList;
+}
+
+// Returns the index in the route of a train of the move currNode -> nextNode, -1 when the move is not on its route
+static int routeFind(const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    if(trainNum <= 0 || trainNum > rbcNRoutes) return -1;
+    const route_t *route = &rbcRoutes[trainNum - 1];
+    for(int i = 0; i + 1 < route->nNodes; i++) {
+        if(route->nodes[i] == currNode && route->nodes[i + 1] == nextNode) return i;
+    }
+    return -1;
+}
+
+// Returns true if the node at index pos of the route of the train enters a single-track section, a run of segments
+// the route shares head-on with other routes, while a train coming the other way holds a segment of it
+static bool headOnBlockedAt(const rbcData_t *rbcData, const int trainNum, const int pos, int32_t *blocker, int *blockerSegm) {
+    const route_t *route = &rbcRoutes[trainNum - 1];
+    const bool *headOn = rbcHeadOn[trainNum - 1];
+    // A train already in the section goes on, only the entry is guarded
+    if(!headOn[pos] || (pos > 0 && headOn[pos - 1])) return false;
+    for(int i = pos; i < route->nNodes && headOn[i]; i++) {
+        const int segm = NODE_NUM(route->nodes[i]);
+        const int32_t holder = atomic_load(&RBC_SEGM(rbcData, segm)->value);
+        if(holder != 0 && holder != trainNum && conflictHeadOn(trainNum, holder, segm)) {
+            *blocker = holder;
+            *blockerSegm = segm;
+            return true;
+        }
+    }
+    return false;
+}
+
+// rbcHeadOnBlocked returns true if the move currNode -> nextNode of a train enters a single-track section of its
+// itinerary while an opposing train is in it: the two trains would end up facing each other. blocker is set to
+// the opposing train and blockerSegm to the segment of the section it holds. The check is sequentially consistent: a train that took nextNode and checks again after
+// sees an opposing train that did the same, so two trains never enter the section from both ends.
+bool rbcHeadOnBlocked(const rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        int32_t *blocker, int *blockerSegm) {
+    if(!rbcHeadOn || NODE_IS_STATION(nextNode)) return false;
+    const int pos = routeFind(trainNum, currNode, nextNode);
+    return pos >= 0 && headOnBlockedAt(rbcData, trainNum, pos + 1, blocker, blockerSegm);
+}
+
+// rbcExtend extends a granted move currNode -> nextNode into a movement authority, along the route of the train.
+// The nodes after nextNode are taken one by one, up to maxNodes of them, until a segment is held or occupied,
+// a segment belongs to another shard, a single-track section is used by an opposing train (DEADLOCK_HOLD),
+// or the destination station is reached.
+// The authority of a replay (see rbcRequestCheck) first takes again the nodes the train still holds: the previous RBC
+// extended it the same way, and nothing changed since.
+// Parameters:
+//   - shard: the shard deciding, only its segments are taken
+//   - replay: the granted move is a replay
+//   - lastNode: set to the last node of the authority when it is extended
+// Returns: the number of nodes added to the authority
+int rbcExtend(rbcData_t *rbcData, const int shard, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        const int maxNodes, const bool replay, int32_t *lastNode) {
+    const int pos = routeFind(trainNum, currNode, nextNode);
+    if(pos < 0 || NODE_IS_STATION(nextNode)) return 0;
+    const route_t *route = &rbcRoutes[trainNum - 1];
+    int added = 0;
+    bool held = replay;
+    rbcWriteBegin(rbcData, shard);
+    for(int i = pos + 2; i < route->nNodes && added < maxNodes; i++) {
+        const int32_t node = route->nodes[i];
+        // The segments still held from the authority granted before the restart are kept, and the station after them
+        held = held && (NODE_IS_STATION(node) || atomic_load(&RBC_SEGM(rbcData, NODE_NUM(node))->value) == trainNum);
+        if(!held && NODE_IS_STATION(node)) {
+            atomic_fetch_add(&RBC_STATION(rbcData, NODE_NUM(node))->value, 1);
+            rbcJournal(node, 1, NODE_NONE, 0);
+        }
+        else if(!held) {
+            int32_t holder = 0;
+            int blockerSegm;
+            const bool hold = deadlockPolicy() == DEADLOCK_HOLD;
+            if(RBC_SEGM_SHARD(rbcData, NODE_NUM(node)) != shard || !isSegmentFree(NODE_NUM(node))) break;
+            // Trains waiting for the segment get it first
+            if(rbcQueueHead(rbcData, NODE_NUM(node)) != 0) break;
+            if(hold && headOnBlockedAt(rbcData, trainNum, i, &holder, &blockerSegm)) break;
+            if(!atomic_compare_exchange_strong(&RBC_SEGM(rbcData, NODE_NUM(node))->value, &holder, trainNum)) break;
+            if(hold && headOnBlockedAt(rbcData, trainNum, i, &holder, &blockerSegm)) {
+                atomic_store(&RBC_SEGM(rbcData, NODE_NUM(node))->value, 0);
+                rbcQueueNotify(rbcData);
+                break;
+            }
+            rbcJournal(node, trainNum, NODE_NONE, 0);
+        }
+        rbcLogUpdate(trainNum, route->nodes[i - 1], node, true);
+        *lastNode = node;
+        added++;
+        if(NODE_IS_STATION(node)) break;
+    }
+    rbcWriteEnd(rbcData, shard, added > 0);
+    return added;
+}
+
+// rbcHandleRelease applies a release frame: the train left a segment of its movement authority.
+// The segment is freed only if the train holds it, invalid releases are ignored.
+void rbcHandleRelease(rbcData_t *rbcData, const int shard, const rbcRequest_t *release) {
+    if(release->version != RBC_PROTO_VERSION || release->trainNum <= 0 || release->trainNum > rbcData->nTrains) return;
+    if(!nodeValid(rbcData, release->currNode) || NODE_IS_STATION(release->currNode)) return;
+    int32_t holder = release->trainNum;
+    rbcWriteBegin(rbcData, shard);
+    const uint64_t slot = rbcJournalReserve();
+    const bool released = atomic_compare_exchange_strong(&RBC_SEGM(rbcData, NODE_NUM(release->currNode))->value, &holder, 0);
+    rbcJournalCommit(slot, released ? release->currNode : NODE_NONE, 0, NODE_NONE, 0);
+    rbcWriteEnd(rbcData, shard, released);
+    if(released) rbcQueueNotify(rbcData);
+}
+
+
+// rbcRequestCheck makes the checks of a request that come before the RBC data is written, for rbcAuthorize and
+// for the workers of the sharded server. A replay, the last move granted to the train before a warm restart, is
+// granted without any change as long as the train holds its next segment. Any other request from a segment the
+// train does not hold is denied: granting it would free the segment of another train.
+// Parameters:
+//   - replay: the request was sent again after a warm restart and rbcCheckpointReplay matches it
+//   - headOn: check that no opposing train is in the single-track section the move enters (DEADLOCK_HOLD)
+//   - holder: set to the train the request waits for when it is denied
+//   - waitSegm: set to the segment the request waits for when it is denied
+// Returns: RBC_GRANTED when the move may be made, or the reason it is denied
+rbcStatus_t rbcRequestCheck(rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode,
+        const bool replay, const bool headOn, int32_t *holder, int *waitSegm) {
+    const bool nextStation = NODE_IS_STATION(nextNode);
+    const int nextID = NODE_NUM(nextNode);
+    *holder = nextStation ? 0 : atomic_load_explicit(&RBC_SEGM(rbcData, nextID)->value, memory_order_acquire);
+    *waitSegm = nextID;
+    if(replay) return nextStation || *holder == trainNum ? RBC_GRANTED : RBC_DENIED_MISMATCH;
+    if(!NODE_IS_STATION(currNode)
+            && atomic_load_explicit(&RBC_SEGM(rbcData, NODE_NUM(currNode))->value, memory_order_acquire) != trainNum)
+        return RBC_DENIED_MISMATCH;
+    if(*holder != 0) return RBC_DENIED_OCCUPIED;
+    // A free segment goes to the first train waiting for it
+    const int32_t queueHead = nextStation ? 0 : rbcQueueHead(rbcData, nextID);
+    if(queueHead != 0 && queueHead != trainNum) {
+        *holder = queueHead;
+        return RBC_DENIED_OCCUPIED;
+    }
+    // The first train of the queue gets the segment as soon as the RBC frees it, the train leaving it may not be out
+    // of the occupancy table yet: TRENO waits for it there
+    if((queueHead != trainNum && !segmStatusChecker(rbcData, nextNode)) || !segmStatusChecker(rbcData, currNode)) return RBC_DENIED_MISMATCH;
+    // The train waits out of the single-track section while an opposing train is in it
+    if(headOn && rbcHeadOnBlocked(rbcData, trainNum, currNode, nextNode, holder, waitSegm)) return RBC_DENIED_OCCUPIED;
+    return RBC_GRANTED;
+}
+
+/* Decides on a request from a train (TRENO) for authorization to advance to a new position.
+The function takes the shared memory data structure and the TRENO's ID, current position, and next position, decides whether to authorize the TRENO to advance to the next position based on the status of the next position in the shared memory data structure and the status of the current and next positions, updates the shared memory data structure and the RBC log file, and returns the authorization decision.
+A replay (see rbcRequestCheck) is granted again without updating the shared memory data structure.
+On RBC_DENIED_OCCUPIED, waitSegm is set to the segment the TRENO waits for: the next one, or the segment of a single-track section
+held by an opposing TRENO. */
+
+rbcStatus_t rbcAuthorize(rbcData_t *rbcData, const int trainNum, const int32_t currNode, const int32_t nextNode, const bool replay,
+        int *waitSegm) {
+    uint64_t stageStart = statsStart();
+    // Check if currNode and nextNode are stations or segments
+    const bool currStation = NODE_IS_STATION(currNode);
+    const bool nextStation = NODE_IS_STATION(nextNode);
+    // Get position IDs
+    const int currID = NODE_NUM(currNode);
+    const int nextID = NODE_NUM(nextNode);
+    const bool hold = deadlockPolicy() == DEADLOCK_HOLD;
+    const bool private = rbcMovePrivate(trainNum, currNode, nextNode);
+    // Train the request waits for when it is denied, and the segment it holds
+    int32_t holder;
+    // RBC decides if TRENO can advance
+    rbcStatus_t status = rbcRequestCheck(rbcData, trainNum, currNode, nextNode, replay, hold && !private, &holder, waitSegm);
+    // A replay updates nothing
+    const bool update = status == RBC_GRANTED && !replay;
+    if(update && private) {
+        // Only this itinerary crosses both segments: no head-on check. The move still goes through the seqlock so
+        // that snapshots never see the train on both segments.
+        // The compare-and-swap only fails if a train off its itinerary took the segment.
+        rbcWriteBegin(rbcData, 0);
+        const bool taken = atomic_compare_exchange_strong(&RBC_SEGM(rbcData, nextID)->value, &holder, trainNum);
+        if(!taken) status = RBC_DENIED_OCCUPIED;
+        else {
+            const uint64_t slot = rbcJournalReserve();
+            atomic_store_explicit(&RBC_SEGM(rbcData, currID)->value, 0, memory_order_release);
+            rbcJournalGrant(slot, trainNum, currNode, nextNode, trainNum, currNode, 0);
+        }
+        rbcWriteEnd(rbcData, 0, taken);
+        if(taken) rbcQueueNotify(rbcData);
+    }
+    else if(update) {
+        // rbcData updates on requests, a segment freed may be promised to a waiting train
+        bool freed = false;
+        rbcWriteBegin(rbcData, 0);
+        if(!nextStation && !atomic_compare_exchange_strong(&RBC_SEGM(rbcData, nextID)->value, &holder, trainNum)) {
+            // Another train took the segment since it was checked
+            status = RBC_DENIED_OCCUPIED;
+        }
+        else if(hold && rbcHeadOnBlocked(rbcData, trainNum, currNode, nextNode, &holder, waitSegm)) {
+            // An opposing train entered the section at the same time: one of the two, or both, back off
+            atomic_store(&RBC_SEGM(rbcData, nextID)->value, 0);
+            status = RBC_DENIED_OCCUPIED;
+            freed = true;
+        }
+        else {
+            // The journal slot is taken before the current segment is freed, see rbcCheckpoint.c
+            const uint64_t slot = rbcJournalReserve();
+            if(nextStation) atomic_fetch_add(&RBC_STATION(rbcData, nextID)->value, 1);
+            if(currStation) atomic_fetch_sub(&RBC_STATION(rbcData, currID)->value, 1);
+            else atomic_store(&RBC_SEGM(rbcData, currID)->value, 0);
+            rbcJournalGrant(slot, trainNum, currNode, nextNode, nextStation ? 1 : trainNum, currNode, currStation ? -1 : 0);
+            freed = !currStation;
+        }
+        rbcWriteEnd(rbcData, 0, status == RBC_GRANTED);
+        if(freed) rbcQueueNotify(rbcData);
+    }
+    rbcWaitUpdate(rbcData, trainNum, status, holder, *waitSegm);
+    statsStage(STATS_DECIDE, stageStart);
+    // RBC updates log
+    stageStart = statsStart();
+    rbcLogUpdate(trainNum, currNode, nextNode, status == RBC_GRANTED);
+    statsStage(STATS_LOG, stageStart);
+    return status;
+}
+
+// Decides on a valid request frame and builds the matching reply frame, see rbcHandleRequest
+static rbcReply_t requestDecide(rbcData_t *rbcData, const rbcRequest_t *request) {
+    rbcReply_t reply = {
+        .version = RBC_PROTO_VERSION,
+        .type = RBC_MSG_REPLY,
+        .reqId = request->reqId,
+        .trainNum = request->trainNum,
+        .grantedNode = NODE_NONE
+    };
+    int waitSegm = 0;
+    if(rbcWithdrawPending(rbcData, request->trainNum)) {
+        rbcWithdraw(rbcData, 0, request->trainNum);
+        reply.status = RBC_DENIED_WITHDRAWN;
+    }
+    else {
+        const bool replay = rbcRequestReplay(request);
+        reply.status = rbcAuthorize(rbcData, request->trainNum, request->currNode, request->nextNode, replay, &waitSegm);
+        if(reply.status == RBC_GRANTED) {
+            reply.nGranted = 1;
+            reply.grantedNode = request->nextNode;
+            if(request->maxNodes > 1) {
+                int32_t lastNode = reply.grantedNode;
+                reply.nGranted += rbcExtend(rbcData, 0, request->trainNum, request->currNode, request->nextNode,
+                        request->maxNodes - 1, replay, &lastNode);
+                reply.grantedNode = lastNode;
+            }
+        }
+    }
+    reply.status = rbcQueueUpdate(rbcData, request, reply.status, waitSegm);
+    return reply;
+}
+
+// Decides on a request frame received from a TRENO session and builds the matching reply frame.
+// Frames with an unknown version or type, or naming unknown nodes, are answered with RBC_BAD_REQUEST.
+// A granted request asking for more than one node is extended into a movement authority by rbcExtend.
+// A train withdrawn to break a deadlock is answered RBC_DENIED_WITHDRAWN, whatever it asks for.
+// A queue frame denied an occupied segment is answered RBC_QUEUED: the server parks it, see rbcQueue.c.
+rbcReply_t rbcHandleRequest(rbcData_t *rbcData, const rbcRequest_t *request) {
+    const uint64_t stageStart = statsStart();
+    const bool valid = rbcRequestValid(rbcData, request);
+    statsStage(STATS_PARSE, stageStart);
+    rbcReply_t reply = {
+        .version = RBC_PROTO_VERSION,
+        .type = RBC_MSG_REPLY,
+        .status = RBC_BAD_REQUEST,
+        .reqId = request->reqId,
+        .trainNum = request->trainNum,
+        .grantedNode = NODE_NONE
+    };
+    if(valid) reply = requestDecide(rbcData, request);
+    statsDecision(request->nextNode, reply.status, false);
+    return reply;
+}
+
+// rbcQueueRetry decides again on a parked request, once rbcQueueReady accepts it.
+// Returns: true when the request is decided, reply is then the reply to push to its session
+bool rbcQueueRetry(rbcData_t *rbcData, const rbcRequest_t *request, rbcReply_t *reply) {
+    if(!rbcQueueReady(rbcData, request->trainNum)) return false;
+    *reply = requestDecide(rbcData, request);
+    if(reply->status == RBC_QUEUED) return false;
+    statsDecision(request->nextNode, reply->status, true);
+    return true;
+}
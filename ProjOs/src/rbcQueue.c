@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../include/includeF.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+
+// Queues of the trains waiting for a segment. A queue frame (RBC_MSG_QUEUE) denied a segment held by another
+// train is answered RBC_QUEUED and parked by the server, and the train joins the queue of the segment: a FIFO
+// list of trains kept in the RBC data, linked through their wait-for state. A free segment with a queue is only
+// granted to the first train of it: the trains get a contested segment in the order they asked for it, and a
+// train asking at the right time no longer overtakes them. When a segment is freed while requests wait,
+// rbcQueueNotify tells the servers, which decide again on the parked requests rbcQueueReady accepts and push
+// the reply to their session:
+//   - fork: the child serving the session sleeps on the wake futex of the RBC data, in rbcQueueWait
+//   - epoll: the server checks its parked requests after each batch of events, when wake changed
+//   - sharded: the worker that parked the request checks them, woken by the hook the server registers
+// A train held out of a single-track section (see rbcHeadOnBlocked) waits in no queue, its request is decided
+// again each time a segment is freed.
+
+static void (*queueHook)(void) = NULL;
+
+// The RBC data is shared between processes, so the futex operations must not be process-private
+static void futexWait(_Atomic uint32_t *word, const uint32_t expected, const struct timespec *timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// The queue of a segment is only changed under its lock, held for a few loads and stores
+static void queueLock(rbcNode_t *segm) {
+    int32_t unlocked = 0;
+    while(!atomic_compare_exchange_weak_explicit(&segm->queueLock, &unlocked, 1, memory_order_acquire, memory_order_relaxed)) {
+        unlocked = 0;
+        sched_yield();
+    }
+}
+
+static void queueUnlock(rbcNode_t *segm) {
+    atomic_store_explicit(&segm->queueLock, 0, memory_order_release);
+}
+
+// Appends a train to the queue of a segment
+static void queueAppend(rbcData_t *rbcData, const int trainNum, const int segmNum) {
+    rbcNode_t *segm = RBC_SEGM(rbcData, segmNum);
+    queueLock(segm);
+    RBC_WAIT(rbcData, trainNum)->queueNext = 0;
+    if(atomic_load_explicit(&segm->queueHead, memory_order_relaxed) == 0) atomic_store(&segm->queueHead, trainNum);
+    else RBC_WAIT(rbcData, segm->queueTail)->queueNext = trainNum;
+    segm->queueTail = trainNum;
+    queueUnlock(segm);
+}
+
+// Removes a train from the queue of a segment
+static void queueRemove(rbcData_t *rbcData, const int trainNum, const int segmNum) {
+    rbcNode_t *segm = RBC_SEGM(rbcData, segmNum);
+    queueLock(segm);
+    int32_t prev = 0, t = atomic_load_explicit(&segm->queueHead, memory_order_relaxed);
+    while(t != 0 && t != trainNum) {
+        prev = t;
+        t = RBC_WAIT(rbcData, t)->queueNext;
+    }
+    if(t != 0) {
+        const int32_t next = RBC_WAIT(rbcData, t)->queueNext;
+        if(prev == 0) atomic_store(&segm->queueHead, next);
+        else RBC_WAIT(rbcData, prev)->queueNext = next;
+        if(segm->queueTail == trainNum) segm->queueTail = prev;
+    }
+    queueUnlock(segm);
+}
+
+// Moves the request of a train to the queue of segm, out of any queue with RBC_QUEUE_HELD, or ends its wait with 0.
+// The requests of a train are decided one at a time: only the thread deciding writes its queuedOn.
+static void queueMove(rbcData_t *rbcData, const int trainNum, const int32_t segm) {
+    rbcWait_t *wait = RBC_WAIT(rbcData, trainNum);
+    const int32_t old = atomic_load_explicit(&wait->queuedOn, memory_order_relaxed);
+    if(old == segm) return;
+    if(old > 0) queueRemove(rbcData, trainNum, old);
+    if(segm > 0) queueAppend(rbcData, trainNum, segm);
+    atomic_store(&wait->queuedOn, segm);
+    if(old == 0) atomic_fetch_add(&rbcData->queues.nWaiting, 1);
+    else if(segm == 0) atomic_fetch_sub(&rbcData->queues.nWaiting, 1);
+    // The train that follows in the queue left may now get the segment
+    if(old > 0 && atomic_load(&RBC_SEGM(rbcData, old)->value) == 0) rbcQueueNotify(rbcData);
+}
+
+// rbcQueueHead returns the first train of the queue of a segment, 0 when no train waits for it.
+// A free segment with a queue is only granted to that train.
+int32_t rbcQueueHead(const rbcData_t *rbcData, const int segmNum) {
+    return atomic_load(&RBC_SEGM(rbcData, segmNum)->queueHead);
+}
+
+// rbcQueueUpdate records the decision on a request in the queues and returns the status to answer: a queue frame
+// denied a segment held by another train, or held out of a single-track section, waits and is answered
+// RBC_QUEUED; any other decision ends the wait of the train.
+// Parameters:
+//   - waitSegm: the segment the request was denied, another segment when the train is held out of a section
+rbcStatus_t rbcQueueUpdate(rbcData_t *rbcData, const rbcRequest_t *request, const rbcStatus_t status, const int waitSegm) {
+    // Only queue frames wait, a plain request never finds its train in a queue
+    if(RBC_MSG_TYPE(request->type) != RBC_MSG_QUEUE) return status;
+    if(status == RBC_DENIED_OCCUPIED) {
+        queueMove(rbcData, request->trainNum, waitSegm == NODE_NUM(request->nextNode) ? waitSegm : RBC_QUEUE_HELD);
+        return RBC_QUEUED;
+    }
+    // Most requests never waited, the line of the train is then only read
+    if(atomic_load_explicit(&RBC_WAIT(rbcData, request->trainNum)->queuedOn, memory_order_relaxed) != 0) {
+        queueMove(rbcData, request->trainNum, 0);
+    }
+    return status;
+}
+
+// rbcQueueLeave ends the wait of a train: withdrawn, or its session closed while its request was parked
+void rbcQueueLeave(rbcData_t *rbcData, const int trainNum) {
+    queueMove(rbcData, trainNum, 0);
+}
+
+// rbcQueueReady returns true if the parked request of a train may be decided again: the train heads the queue of
+// a free segment, it is held out of a section, or it was withdrawn
+bool rbcQueueReady(const rbcData_t *rbcData, const int trainNum) {
+    if(rbcWithdrawPending(rbcData, trainNum)) return true;
+    const int32_t segm = atomic_load(&RBC_WAIT(rbcData, trainNum)->queuedOn);
+    if(segm <= 0) return true;
+    return rbcQueueHead(rbcData, segm) == trainNum && atomic_load(&RBC_SEGM(rbcData, segm)->value) == 0;
+}
+
+// rbcQueueNotify is called once a segment is freed, or a train withdrawn: parked requests may now be decided.
+// Without requests waiting it costs a fence and a load.
+void rbcQueueNotify(rbcData_t *rbcData) {
+    rbcQueues_t *queues = &rbcData->queues;
+    // Pairs with the parking of a request: either its server sees the segment free, or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&queues->nWaiting, memory_order_relaxed) == 0) return;
+    atomic_fetch_add(&queues->wake, 1);
+    if(atomic_load(&queues->sleepers) > 0) futexWake(&queues->wake);
+    if(queueHook) queueHook();
+}
+
+// rbcQueueSetHook registers a function called by rbcQueueNotify in the current process.
+// The workers of the sharded server do not sleep on the wake futex, they are woken by the hook instead.
+void rbcQueueSetHook(void (*hook)(void)) {
+    queueHook = hook;
+}
+
+// rbcQueueWait blocks the fork child serving a train until its parked request is decided.
+// Returns: the reply to push to the train
+rbcReply_t rbcQueueWait(rbcData_t *rbcData, const rbcRequest_t *request) {
+    rbcQueues_t *queues = &rbcData->queues;
+    // Bounds the wait, should a wake-up be lost
+    const struct timespec timeout = { .tv_sec = RBC_QUEUE_CHECK_MS / 1000, .tv_nsec = (RBC_QUEUE_CHECK_MS % 1000) * 1000000L };
+    rbcReply_t reply;
+    while(true) {
+        // Read before the check, so that a notification in between is not missed
+        const uint32_t seen = atomic_load(&queues->wake);
+        if(rbcQueueRetry(rbcData, request, &reply)) return reply;
+        atomic_fetch_add(&queues->sleepers, 1);
+        futexWait(&queues->wake, seen, &timeout);
+        atomic_fetch_sub(&queues->sleepers, 1);
+    }
+}
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../include/includeF.h"
+#include "../include/includeL.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeK.h"
+#include "../include/includeS.h"
+
+// Sharded server: the segments are split in slices between worker threads, each pinned to a core.
+// A worker is the only thread writing the segments of its slice, so it decides on them with plain
+// loads and stores, without compare-and-swap nor locks. The main thread accepts the sessions and reads
+// the frames, then queues each request to the worker owning the segment the train asks for (to the owner
+// of the segment it leaves when it asks for a station). The worker answers on the session itself.
+// Cross-shard move: the worker owning the next segment claims it and queues the release of the current
+// segment to the worker owning it. Until that worker applies it the train holds both segments, so a
+// segment is never seen free while a train may still be on it; a request for it meanwhile is denied
+// as occupied and retried by the train.
+// Queued requests (see rbcQueue.c) are parked by the worker that decided them, which decides again on them
+// when a segment is freed: its own releases, or the queue hook waking it for a segment freed by another worker.
+
+// TYPEDEFS
+// TRENO session. The main thread reads its frames, the workers send the replies.
+typedef struct shardConn_t {
+    int fd;
+    size_t len;
+    rbcRequest_t request;
+    atomic_int refs;                // the main thread while the session is open, and one per queued or parked request
+    atomic_bool closed;             // the TRENO closed the session, its parked requests are dropped
+    pthread_mutex_t sendLock;       // replies of different workers to the same session
+} shardConn_t;
+// Message queued to a worker: a request of a session, or without session the release of the
+// segment currNode after a cross-shard move
+typedef struct shardMsg_t {
+    shardConn_t *conn;
+    rbcRequest_t request;
+} shardMsg_t;
+typedef struct shardSlot_t {
+    atomic_size_t seq;
+    shardMsg_t msg;
+} shardSlot_t;
+// Bounded multi-producer single-consumer queue, the same scheme as the log ring (see log.c): a slot
+// is free for the producer claiming position pos when its seq is pos, and holds a message when seq is pos + 1
+typedef struct shardRing_t {
+    shardSlot_t *slots;
+    size_t mask;
+    atomic_size_t tail __attribute__((aligned(CACHE_LINE)));
+    size_t head __attribute__((aligned(CACHE_LINE)));
+} shardRing_t;
+typedef struct shard_t {
+    int index;
+    pthread_t thread;
+    rbcData_t *rbcData;
+    shardRing_t requests;           // from the main thread
+    shardRing_t releases;           // from the other workers, two slots per segment of the slice: never full
+    shardMsg_t *parked;             // queued requests waiting for their segment
+    int nParked, parkedCapacity;
+    uint32_t parkedWake;            // wake count of the RBC data the parked requests were last checked at
+    atomic_bool hasParked;          // read by the queue hook in the other workers
+    atomic_int wakeSeq __attribute__((aligned(CACHE_LINE)));    // futex word the worker sleeps on
+    atomic_bool sleeping;
+} __attribute__((aligned(CACHE_LINE))) shard_t;
+
+static shard_t *shards = NULL;
+
+// The queues and their futex are only used by the threads of the RBC
+static void futexWait(atomic_int *word, const int expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(atomic_int *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Empty queue of capacity slots, capacity is a power of two
+static void ringInit(shardRing_t *ring, const size_t capacity) {
+    ring->slots = (shardSlot_t *)calloc(capacity, sizeof(shardSlot_t));
+    if(!ring->slots) throwError("Failed to allocate shard queue");
+    for(size_t i = 0; i < capacity; i++) atomic_init(&ring->slots[i].seq, i);
+    ring->mask = capacity - 1;
+    atomic_init(&ring->tail, 0);
+    ring->head = 0;
+}
+
+// Returns: false if the queue is full
+static bool ringPush(shardRing_t *ring, const shardMsg_t *msg) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    shardSlot_t *slot;
+    while(true) {
+        slot = &ring->slots[pos & ring->mask];
+        const intptr_t diff = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)pos;
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if(diff < 0) return false;
+        else pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+    slot->msg = *msg;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+// Returns: false if the queue is empty
+static bool ringPop(shardRing_t *ring, shardMsg_t *msg) {
+    shardSlot_t *slot = &ring->slots[ring->head & ring->mask];
+    if(atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->head + 1) return false;
+    *msg = slot->msg;
+    // The slot can be claimed again one lap later
+    atomic_store_explicit(&slot->seq, ring->head + ring->mask + 1, memory_order_release);
+    ring->head++;
+    return true;
+}
+
+static bool ringReady(shardRing_t *ring) {
+    return atomic_load_explicit(&ring->slots[ring->head & ring->mask].seq, memory_order_acquire) == ring->head + 1;
+}
+
+// Wakes a worker after a push, if it sleeps
+static void shardWake(shard_t *shard) {
+    // Pairs with the fence of the worker going to sleep: either it sees the message or we see it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&shard->sleeping, memory_order_relaxed)) {
+        atomic_fetch_add(&shard->wakeSeq, 1);
+        futexWake(&shard->wakeSeq);
+    }
+}
+
+// Queues the release of a segment to the worker owning it, with the train expected to hold it
+// Returns: false if the queue of the worker is full
+static bool shardQueueRelease(const int owner, const int trainNum, const int32_t node) {
+    const shardMsg_t release = { .conn = NULL, .request = { .trainNum = trainNum, .currNode = node } };
+    if(!ringPush(&shards[owner].releases, &release)) return false;
+    shardWake(&shards[owner]);
+    return true;
+}
+
+// Drops a reference to a session, the last one closes it
+static void shardConnRelease(shardConn_t *conn) {
+    if(atomic_fetch_sub(&conn->refs, 1) != 1) return;
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->sendLock);
+    free(conn);
+}
+
+static void shardSend(shardConn_t *conn, const rbcReply_t *reply) {
+    pthread_mutex_lock(&conn->sendLock);
+    const bool sent = sendAll(conn->fd, reply, sizeof(*reply));
+    pthread_mutex_unlock(&conn->sendLock);
+    // The main thread sees the session closed and drops it
+    if(!sent) perror("Failed to send authorization to TRENO");
+}
+
+// Decides on a request in the worker owning its next segment, as rbcAuthorize does.
+// The next segment is only written by this worker: it is checked and taken without compare-and-swap.
+static rbcStatus_t shardAuthorize(shard_t *shard, const int trainNum, const int32_t currNode, const int32_t nextNode, const bool replay,
+        int *waitSegm) {
+    uint64_t stageStart = statsStart();
+    rbcData_t *rbcData = shard->rbcData;
+    const bool currStation = NODE_IS_STATION(currNode);
+    const bool nextStation = NODE_IS_STATION(nextNode);
+    const int currID = NODE_NUM(currNode);
+    const int nextID = NODE_NUM(nextNode);
+    const bool hold = deadlockPolicy() == DEADLOCK_HOLD;
+    int32_t holder;
+    rbcStatus_t status = rbcRequestCheck(rbcData, trainNum, currNode, nextNode, replay, hold, &holder, waitSegm);
+    if(status == RBC_GRANTED && !replay) {
+        bool freed = false;
+        rbcWriteBegin(rbcData, shard->index);
+        if(nextStation) atomic_fetch_add(&RBC_STATION(rbcData, nextID)->value, 1);
+        else atomic_store_explicit(&RBC_SEGM(rbcData, nextID)->value, trainNum, memory_order_relaxed);
+        // Checked again once the segment is taken, as in rbcAuthorize: the section may belong to other workers
+        bool blocked = false;
+        if(hold && !nextStation) {
+            atomic_thread_fence(memory_order_seq_cst);
+            blocked = rbcHeadOnBlocked(rbcData, trainNum, currNode, nextNode, &holder, waitSegm);
+        }
+        // The journal slot is taken before the current segment is freed, see rbcCheckpoint.c
+        const uint64_t slot = blocked ? 0 : rbcJournalReserve();
+        if(blocked) {
+            atomic_store_explicit(&RBC_SEGM(rbcData, nextID)->value, 0, memory_order_relaxed);
+            status = RBC_DENIED_OCCUPIED;
+            freed = true;
+        }
+        else if(currStation) {
+            atomic_fetch_sub(&RBC_STATION(rbcData, currID)->value, 1);
+            rbcJournalGrant(slot, trainNum, currNode, nextNode, nextStation ? 1 : trainNum, currNode, -1);
+        }
+        else if(RBC_SEGM_SHARD(rbcData, currID) == shard->index) {
+            atomic_store_explicit(&RBC_SEGM(rbcData, currID)->value, 0, memory_order_relaxed);
+            rbcJournalGrant(slot, trainNum, currNode, nextNode, nextStation ? 1 : trainNum, currNode, 0);
+            freed = true;
+        }
+        else if(!shardQueueRelease(RBC_SEGM_SHARD(rbcData, currID), trainNum, currNode)) {
+            // The release queue of the owner is full: the move is taken back and denied, the RBC keeps running
+            if(nextStation) atomic_fetch_sub(&RBC_STATION(rbcData, nextID)->value, 1);
+            else atomic_store_explicit(&RBC_SEGM(rbcData, nextID)->value, 0, memory_order_relaxed);
+            rbcJournalCommit(slot, NODE_NONE, 0, NODE_NONE, 0);
+            printf("RBC TRENO %d denied: release queue of shard %d full.\n", trainNum, RBC_SEGM_SHARD(rbcData, currID));
+            status = RBC_DENIED_MISMATCH;
+            freed = !nextStation;
+        }
+        else {
+            // Cross-shard move: the owner of the current segment releases it
+            rbcJournalGrant(slot, trainNum, currNode, nextNode, nextStation ? 1 : trainNum, NODE_NONE, 0);
+        }
+        rbcWriteEnd(rbcData, shard->index, status == RBC_GRANTED);
+        if(freed) rbcQueueNotify(rbcData);
+    }
+    rbcWaitUpdate(rbcData, trainNum, status, holder, *waitSegm);
+    statsStage(STATS_DECIDE, stageStart);
+    stageStart = statsStart();
+    rbcLogUpdate(trainNum, currNode, nextNode, status == RBC_GRANTED);
+    statsStage(STATS_LOG, stageStart);
+    return status;
+}
+
+// Applies the release of a segment of the slice queued by another worker, after a cross-shard move or a
+// withdrawal. The segment is freed only if the train still holds it.
+static void shardRelease(shard_t *shard, const rbcRequest_t *release) {
+    int32_t holder = release->trainNum;
+    rbcWriteBegin(shard->rbcData, shard->index);
+    const uint64_t slot = rbcJournalReserve();
+    const bool released = atomic_compare_exchange_strong(&RBC_SEGM(shard->rbcData, NODE_NUM(release->currNode))->value, &holder, 0);
+    rbcJournalCommit(slot, released ? release->currNode : NODE_NONE, 0, NODE_NONE, 0);
+    rbcWriteEnd(shard->rbcData, shard->index, released);
+    if(released) rbcQueueNotify(shard->rbcData);
+}
+
+// Frees a segment of another worker for rbcWithdraw. The owner may itself wait for room in the releases of this
+// worker: they are applied meanwhile.
+static void shardWithdrawRelease(const int shard, const int owner, const int trainNum, const int segmNum) {
+    shardMsg_t msg;
+    while(!shardQueueRelease(owner, trainNum, NODE_SEGM(segmNum))) {
+        while(ringPop(&shards[shard].releases, &msg)) shardRelease(&shards[shard], &msg.request);
+        sched_yield();
+    }
+}
+
+// Decides on a request in its worker, as rbcHandleRequest does
+static rbcReply_t shardDecide(shard_t *shard, const rbcRequest_t *request) {
+    rbcReply_t reply = {
+        .version = RBC_PROTO_VERSION,
+        .type = RBC_MSG_REPLY,
+        .reqId = request->reqId,
+        .trainNum = request->trainNum,
+        .grantedNode = NODE_NONE
+    };
+    int waitSegm = 0;
+    const bool replay = rbcRequestReplay(request);
+    if(rbcWithdrawPending(shard->rbcData, request->trainNum)) {
+        rbcWithdraw(shard->rbcData, shard->index, request->trainNum);
+        reply.status = RBC_DENIED_WITHDRAWN;
+    }
+    else reply.status = shardAuthorize(shard, request->trainNum, request->currNode, request->nextNode, replay, &waitSegm);
+    if(reply.status == RBC_GRANTED) {
+        reply.nGranted = 1;
+        reply.grantedNode = request->nextNode;
+        // The authority stops at the end of the slice of the worker
+        if(request->maxNodes > 1) {
+            int32_t lastNode = reply.grantedNode;
+            reply.nGranted += rbcExtend(shard->rbcData, shard->index, request->trainNum, request->currNode, request->nextNode,
+                    request->maxNodes - 1, replay, &lastNode);
+            reply.grantedNode = lastNode;
+        }
+    }
+    reply.status = rbcQueueUpdate(shard->rbcData, request, reply.status, waitSegm);
+    return reply;
+}
+
+// Parks a queued request, with its reference to the session, until it is decided
+static void shardPark(shard_t *shard, const shardMsg_t *msg) {
+    if(shard->nParked == shard->parkedCapacity) {
+        shard->parkedCapacity = shard->parkedCapacity ? shard->parkedCapacity * 2 : 16;
+        shard->parked = (shardMsg_t *)realloc(shard->parked, shard->parkedCapacity * sizeof(shardMsg_t));
+        if(!shard->parked) throwError("Failed to allocate parked requests");
+    }
+    shard->parked[shard->nParked++] = *msg;
+    atomic_store(&shard->hasParked, true);
+}
+
+// Returns true if a segment was freed since the parked requests were last checked
+static bool shardParkedChanged(shard_t *shard) {
+    return shard->nParked > 0 && atomic_load(&shard->rbcData->queues.wake) != shard->parkedWake;
+}
+
+// Decides again on the parked requests once a segment was freed, and pushes the decisions to their sessions.
+// The parked requests of closed sessions are dropped.
+// Returns: true if a request was decided or dropped
+static bool shardRetry(shard_t *shard) {
+    if(!shardParkedChanged(shard)) return false;
+    shard->parkedWake = atomic_load(&shard->rbcData->queues.wake);
+    bool progress = false;
+    for(int i = 0; i < shard->nParked; ) {
+        shardMsg_t *msg = &shard->parked[i];
+        if(atomic_load(&msg->conn->closed)) rbcQueueLeave(shard->rbcData, msg->request.trainNum);
+        else if(!rbcQueueReady(shard->rbcData, msg->request.trainNum)) {
+            i++;
+            continue;
+        }
+        else {
+            const rbcReply_t reply = shardDecide(shard, &msg->request);
+            if(reply.status == RBC_QUEUED) {
+                i++;
+                continue;
+            }
+            statsDecision(msg->request.nextNode, reply.status, true);
+            shardSend(msg->conn, &reply);
+        }
+        shardConnRelease(msg->conn);
+        shard->parked[i] = shard->parked[--shard->nParked];
+        progress = true;
+    }
+    atomic_store(&shard->hasParked, shard->nParked > 0);
+    return progress;
+}
+
+// Wakes the workers holding parked requests, called by rbcQueueNotify when a segment is freed
+static void shardQueueWake() {
+    for(int s = 0; s < shards[0].rbcData->nShards; s++) {
+        if(atomic_load(&shards[s].hasParked)) shardWake(&shards[s]);
+    }
+}
+
+// Decides on a queued request and answers its session, or applies a release reported by a train.
+// A request answered RBC_QUEUED is parked.
+static void shardServe(shard_t *shard, const shardMsg_t *msg) {
+    const rbcRequest_t *request = &msg->request;
+    if(request->type == RBC_MSG_RELEASE) {
+        rbcHandleRelease(shard->rbcData, shard->index, request);
+        statsQueue(-1);
+        shardConnRelease(msg->conn);
+        return;
+    }
+    const rbcReply_t reply = shardDecide(shard, request);
+    statsDecision(request->nextNode, reply.status, false);
+    shardSend(msg->conn, &reply);
+    statsQueue(-1);
+    if(reply.status == RBC_QUEUED) shardPark(shard, msg);
+    else shardConnRelease(msg->conn);
+}
+
+// Pins the calling worker to a core the RBC may run on, round-robin
+static void shardPin(const int index) {
+    cpu_set_t allowed, cpu;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || CPU_COUNT(&allowed) == 0) return;
+    int n = index % CPU_COUNT(&allowed);
+    for(int c = 0; c < CPU_SETSIZE; c++) {
+        if(!CPU_ISSET(c, &allowed) || n-- > 0) continue;
+        CPU_ZERO(&cpu);
+        CPU_SET(c, &cpu);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+        return;
+    }
+}
+
+// Worker thread: applies the releases, then decides on the requests and on the parked requests, and sleeps when
+// both queues are empty and no segment was freed for the parked requests
+static void *shardRun(void *arg) {
+    shard_t *shard = (shard_t *)arg;
+    shardPin(shard->index);
+    shardMsg_t msg;
+    while(true) {
+        const int seen = atomic_load(&shard->wakeSeq);
+        bool idle = true;
+        // Releases first, they free segments the queued requests may ask for
+        while(ringPop(&shard->releases, &msg)) {
+            shardRelease(shard, &msg.request);
+            idle = false;
+        }
+        while(ringPop(&shard->requests, &msg)) {
+            shardServe(shard, &msg);
+            idle = false;
+        }
+        // Then the parked requests, the segments they wait for may have been freed
+        if(shardRetry(shard)) idle = false;
+        if(!idle) continue;
+        atomic_store(&shard->sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(!ringReady(&shard->releases) && !ringReady(&shard->requests) && !shardParkedChanged(shard)) futexWait(&shard->wakeSeq, seen);
+        atomic_store(&shard->sleeping, false);
+    }
+    return NULL;
+}
+
+// rbcShardCount returns the workers of the sharded server: RAIL_RBC_SHARDS or one per online core,
+// at most one per segment
+int rbcShardCount(const int nSegm) {
+    const char *env = getenv(RBC_SHARDS_ENV);
+    int nShards = env && atoi(env) > 0 ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nShards > RBC_MAX_SHARDS) nShards = RBC_MAX_SHARDS;
+    if(nShards > nSegm) nShards = nSegm;
+    return nShards > 0 ? nShards : 1;
+}
+
+// Starts the workers, one per shard of the RBC data
+static void shardsStart(rbcData_t *rbcData) {
+    shards = (shard_t *)aligned_alloc(CACHE_LINE, rbcData->nShards * sizeof(shard_t));
+    if(!shards) throwError("Failed to allocate shards");
+    memset(shards, 0, rbcData->nShards * sizeof(shard_t));
+    int owned[RBC_MAX_SHARDS] = { 0 };
+    for(int n = 1; n <= rbcData->nSegm; n++) owned[RBC_SEGM_SHARD(rbcData, n)]++;
+    for(int s = 0; s < rbcData->nShards; s++) {
+        shard_t *shard = &shards[s];
+        shard->index = s;
+        shard->rbcData = rbcData;
+        ringInit(&shard->requests, RBC_SHARD_QUEUE);
+        // A segment is released once before it can be taken again, after a cross-shard move of the train holding it
+        // (see rbcRequestCheck), and once more if the train is withdrawn meanwhile: the releases pending for a shard
+        // never outnumber twice its segments
+        size_t capacity = 1;
+        while(capacity < 2 * (size_t)owned[s]) capacity *= 2;
+        ringInit(&shard->releases, capacity);
+        atomic_init(&shard->wakeSeq, 0);
+        atomic_init(&shard->sleeping, false);
+    }
+    rbcQueueSetHook(shardQueueWake);
+    rbcWithdrawSetHook(shardWithdrawRelease);
+    for(int s = 0; s < rbcData->nShards; s++) {
+        if(pthread_create(&shards[s].thread, NULL, shardRun, &shards[s]) != 0) throwError("Failed to start shard worker");
+    }
+}
+
+// Queues a request to the worker owning it, or answers it at once when the frame is invalid.
+// A release goes to the worker owning the segment left.
+static void shardDispatch(rbcData_t *rbcData, shardConn_t *conn) {
+    const uint64_t stageStart = statsStart();
+    const bool release = conn->request.type == RBC_MSG_RELEASE;
+    const bool valid = release ? nodeValid(rbcData, conn->request.currNode) && !NODE_IS_STATION(conn->request.currNode)
+            : rbcRequestValid(rbcData, &conn->request);
+    if(release && !valid) return;
+    statsStage(STATS_PARSE, stageStart);
+    if(!valid) {
+        const rbcReply_t reply = {
+            .version = RBC_PROTO_VERSION,
+            .type = RBC_MSG_REPLY,
+            .status = RBC_BAD_REQUEST,
+            .reqId = conn->request.reqId,
+            .trainNum = conn->request.trainNum,
+            .grantedNode = NODE_NONE
+        };
+        statsDecision(conn->request.nextNode, RBC_BAD_REQUEST, false);
+        shardSend(conn, &reply);
+        return;
+    }
+    const int32_t currNode = conn->request.currNode, nextNode = conn->request.nextNode;
+    int owner = 0;
+    if(release) owner = RBC_SEGM_SHARD(rbcData, NODE_NUM(currNode));
+    else if(!NODE_IS_STATION(nextNode)) owner = RBC_SEGM_SHARD(rbcData, NODE_NUM(nextNode));
+    else if(!NODE_IS_STATION(currNode)) owner = RBC_SEGM_SHARD(rbcData, NODE_NUM(currNode));
+    shard_t *shard = &shards[owner];
+    const shardMsg_t msg = { .conn = conn, .request = conn->request };
+    atomic_fetch_add(&conn->refs, 1);
+    statsQueue(1);
+    while(!ringPush(&shard->requests, &msg)) {
+        // The worker is behind: let it catch up
+        shardWake(shard);
+        sched_yield();
+    }
+    shardWake(shard);
+}
+
+// Reads the frames available on a ready session and dispatches them.
+// Returns false when the TRENO closed its session.
+static bool shardReadClient(rbcData_t *rbcData, shardConn_t *conn) {
+    while(true) {
+        // The socket stays blocking for the workers sending on it, only this read must not block
+        const ssize_t received = recv(conn->fd, (char *)&conn->request + conn->len, sizeof(conn->request) - conn->len, MSG_DONTWAIT);
+        if(received == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if(errno == EINTR) continue;
+            perror("Failed to receive message from TRENO");
+            return false;
+        }
+        if(received == 0) return false;
+        conn->len += received;
+        if(conn->len < sizeof(conn->request)) continue;
+        conn->len = 0;
+        shardDispatch(rbcData, conn);
+    }
+}
+
+// rbcServeSharded serves every TRENO session with one worker thread per shard of the RBC data.
+// The main thread multiplexes the server socket, the sessions and the signals of the RBC with epoll, as rbcServeEpoll does.
+// The workers inherit the signals blocked by the RBC, so that only the main thread reads them.
+void rbcServeSharded(const int server_fd, const int signal_fd, rbcData_t *rbcData) {
+    shardsStart(rbcData);
+    if(fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK) == -1) throwError("Failed to set server socket non-blocking");
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1) throwError("Failed to create epoll instance");
+    // The server socket is the only event without a session
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1) throwError("Failed to watch server socket");
+    struct epoll_event signalEvent = { .events = EPOLLIN, .data.ptr = RBC_SIGNAL_EVENT };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signalEvent) == -1) throwError("Failed to watch signal descriptor");
+    struct epoll_event events[RBC_MAX_EVENTS];
+    printf("RBC Server waiting for TRENO requests, %d shards.\n", rbcData->nShards);
+    while (true) {
+        const int nEvents = epoll_wait(epoll_fd, events, RBC_MAX_EVENTS, -1);
+        if(nEvents == -1) {
+            if(errno == EINTR) continue;
+            throwError("Error waiting for TRENO requests");
+        }
+        for(int i = 0; i < nEvents; i++) {
+            shardConn_t *conn = (shardConn_t *)events[i].data.ptr;
+            if(conn == RBC_SIGNAL_EVENT) {
+                if(superviseSignal()) rbcShutdown();
+            }
+            else if(!conn) {
+                // Accept every pending connection
+                int client_fd;
+                uint64_t acceptStart = statsStart();
+                while((client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+                    shardConn_t *newConn = (shardConn_t *)calloc(1, sizeof(shardConn_t));
+                    if(!newConn) throwError("Failed to allocate TRENO connection");
+                    newConn->fd = client_fd;
+                    atomic_init(&newConn->refs, 1);
+                    atomic_init(&newConn->closed, false);
+                    pthread_mutex_init(&newConn->sendLock, NULL);
+                    struct epoll_event clientEvent = { .events = EPOLLIN, .data.ptr = newConn };
+                    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &clientEvent) == -1) throwError("Failed to watch TRENO socket");
+                    statsSession(true);
+                    statsStage(STATS_ACCEPT, acceptStart);
+                    acceptStart = statsStart();
+                }
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) throwError("Error accepting TRENO request");
+            }
+            else if(!shardReadClient(rbcData, conn)) {
+                // The workers may still be answering its last requests, the last reference closes it
+                atomic_store(&conn->closed, true);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                shardConnRelease(conn);
+                statsSession(false);
+            }
+        }
+    }
+}
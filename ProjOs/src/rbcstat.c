@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeK.h"
+#include "../include/includeR.h"
+
+// RBCSTAT
+// Reads the statistics region of the running RBC and a snapshot of the stations and segments of the RBC
+// data, both mapped read-only: the server is never stopped nor locked. Prints a summary, or with -p the
+// Prometheus text exposition format. With -i the statistics are printed again every interval seconds. Usage: bin/rbcstat [-p] [-i seconds]
+
+// MACROS
+#define STAT_LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+
+static const char *stageNames[STATS_N_STAGES] = { "accept", "parse", "decide", "log" };
+static const char *statusNames[STATS_N_STATUS] = { "granted", "denied_occupied", "denied_mismatch", "bad_request", "denied_withdrawn", "queued" };
+
+// Returns the upper bound in ns of the bucket holding the fraction q of the durations of a stage
+static uint64_t histPercentile(const statsHist_t *hist, const double q) {
+    const uint64_t count = STAT_LOAD(hist->count);
+    if(count == 0) return 0;
+    uint64_t seen = 0;
+    for(int i = 0; i < STATS_N_BUCKETS - 1; i++) {
+        seen += STAT_LOAD(hist->buckets[i]);
+        if(seen >= q * count) return statsBucketBound(i);
+    }
+    return statsBucketBound(STATS_N_BUCKETS - 2) * 2;
+}
+
+// Maps the RBC data read-only.
+// Returns: the RBC data, NULL if the RBC did not create it
+static const rbcData_t *rbcDataAttach() {
+    const int fd = shm_open(SHM_NAME, O_RDONLY, 0);
+    if(fd == -1) return NULL;
+    struct stat fs;
+    const rbcData_t *rbcData = NULL;
+    if(fstat(fd, &fs) == 0 && (size_t)fs.st_size >= sizeof(rbcData_t)) {
+        rbcData = (const rbcData_t *)mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(rbcData == MAP_FAILED) rbcData = NULL;
+        else if(rbcData->nShards > RBC_MAX_SHARDS || RBC_DATA_SIZE(rbcData->nStations, rbcData->nSegm, rbcData->nShards, rbcData->nTrains) > (size_t)fs.st_size) {
+            munmap((void *)rbcData, fs.st_size);
+            rbcData = NULL;
+        }
+    }
+    close(fd);
+    return rbcData;
+}
+
+// Consistent copy of the stations and segments of the RBC data
+typedef struct stateSnapshot_t {
+    uint32_t version;
+    int32_t *stations;
+    int32_t *segms;
+} stateSnapshot_t;
+
+static bool takeSnapshot(const rbcData_t *rbcData, stateSnapshot_t *snapshot) {
+    if(!rbcData) return false;
+    snapshot->stations = (int32_t *)calloc(rbcData->nStations + rbcData->nSegm, sizeof(int32_t));
+    if(!snapshot->stations) throwError("Failed to allocate snapshot");
+    snapshot->segms = snapshot->stations + rbcData->nStations;
+    snapshot->version = rbcDataSnapshot(rbcData, snapshot->stations, snapshot->segms);
+    return true;
+}
+
+static void printSummary(const rbcStats_t *stats, const rbcData_t *rbcData) {
+    printf("RBC pid %d, up %lld s\n", stats->pid, (long long)(time(NULL) - stats->startTime));
+    printf("requests %llu:", (unsigned long long)STAT_LOAD(stats->requests));
+    for(int i = 0; i < STATS_N_STATUS; i++) printf(" %s %llu", statusNames[i], (unsigned long long)STAT_LOAD(stats->status[i]));
+    printf("\npushed to queued requests %llu", (unsigned long long)STAT_LOAD(stats->pushed));
+    printf("\nsessions open %lld, accepted %llu\n", (long long)STAT_LOAD(stats->sessionsOpen),
+            (unsigned long long)STAT_LOAD(stats->sessionsAccepted));
+    printf("queue depth %lld, max %lld\n", (long long)STAT_LOAD(stats->queueDepth), (long long)STAT_LOAD(stats->queueDepthMax));
+    printf("deadlocks %llu\n", (unsigned long long)STAT_LOAD(stats->deadlocks));
+    printf("%-8s %12s %10s %10s %10s\n", "stage", "count", "mean us", "p50 us", "p99 us");
+    for(int i = 0; i < STATS_N_STAGES; i++) {
+        const statsHist_t *hist = &stats->stages[i];
+        const uint64_t count = STAT_LOAD(hist->count);
+        printf("%-8s %12llu %10.2f %10.2f %10.2f\n", stageNames[i], (unsigned long long)count,
+                count ? STAT_LOAD(hist->sumNs) / 1e3 / count : 0.0, histPercentile(hist, 0.5) / 1e3, histPercentile(hist, 0.99) / 1e3);
+    }
+    printf("%-8s %12s %12s\n", "segment", "granted", "denied");
+    for(int i = 0; i < stats->nSegm; i++) {
+        const uint64_t granted = STAT_LOAD(stats->segms[i].granted), denied = STAT_LOAD(stats->segms[i].denied);
+        if(granted || denied) printf("MA%-6d %12llu %12llu\n", i + 1, (unsigned long long)granted, (unsigned long long)denied);
+    }
+    stateSnapshot_t snapshot;
+    if(!takeSnapshot(rbcData, &snapshot)) return;
+    printf("state version %u\nstations:", snapshot.version);
+    for(int i = 0; i < rbcData->nStations; i++) printf(" S%d=%d", i + 1, snapshot.stations[i]);
+    printf("\nsegments held:");
+    for(int i = 0; i < rbcData->nSegm; i++) {
+        if(snapshot.segms[i]) printf(" MA%d=T%d", i + 1, snapshot.segms[i]);
+    }
+    // The wait-for graph of the deadlock detection, outside the snapshot
+    printf("\ntrains waiting:");
+    for(int t = 1; t <= rbcData->nTrains; t++) {
+        const uint64_t edge = atomic_load_explicit(&RBC_WAIT(rbcData, t)->edge, memory_order_relaxed);
+        if(edge) printf(" T%d->T%d(MA%d)", t, WAIT_HOLDER(edge), WAIT_SEGM(edge));
+    }
+    // The queues of the segments, from their first train
+    printf("\nsegment queues:");
+    for(int i = 1; i <= rbcData->nSegm; i++) {
+        int32_t t = atomic_load_explicit(&RBC_SEGM(rbcData, i)->queueHead, memory_order_relaxed);
+        if(!t) continue;
+        printf(" MA%d=", i);
+        for(int hops = 0; t > 0 && t <= rbcData->nTrains && hops < rbcData->nTrains; hops++) {
+            printf(hops ? ",T%d" : "T%d", t);
+            t = RBC_WAIT(rbcData, t)->queueNext;
+        }
+    }
+    printf("\n");
+    free(snapshot.stations);
+}
+
+static void printPrometheus(const rbcStats_t *stats, const rbcData_t *rbcData) {
+    printf("# HELP rbc_start_time_seconds Start time of the RBC since the epoch.\n# TYPE rbc_start_time_seconds gauge\n");
+    printf("rbc_start_time_seconds %lld\n", (long long)stats->startTime);
+    printf("# HELP rbc_requests_total Authorization requests received.\n# TYPE rbc_requests_total counter\n");
+    printf("rbc_requests_total %llu\n", (unsigned long long)STAT_LOAD(stats->requests));
+    printf("# HELP rbc_pushed_total Decisions pushed to queued requests, also counted in rbc_replies_total.\n# TYPE rbc_pushed_total counter\n");
+    printf("rbc_pushed_total %llu\n", (unsigned long long)STAT_LOAD(stats->pushed));
+    printf("# HELP rbc_replies_total Replies by status.\n# TYPE rbc_replies_total counter\n");
+    for(int i = 0; i < STATS_N_STATUS; i++) {
+        printf("rbc_replies_total{status=\"%s\"} %llu\n", statusNames[i], (unsigned long long)STAT_LOAD(stats->status[i]));
+    }
+    printf("# HELP rbc_sessions_accepted_total TRENO sessions accepted.\n# TYPE rbc_sessions_accepted_total counter\n");
+    printf("rbc_sessions_accepted_total %llu\n", (unsigned long long)STAT_LOAD(stats->sessionsAccepted));
+    printf("# HELP rbc_sessions_open TRENO sessions open.\n# TYPE rbc_sessions_open gauge\n");
+    printf("rbc_sessions_open %lld\n", (long long)STAT_LOAD(stats->sessionsOpen));
+    printf("# HELP rbc_queue_depth Requests or ready sessions waiting to be served.\n# TYPE rbc_queue_depth gauge\n");
+    printf("rbc_queue_depth %lld\n", (long long)STAT_LOAD(stats->queueDepth));
+    printf("# HELP rbc_queue_depth_max Highest queue depth since the start.\n# TYPE rbc_queue_depth_max gauge\n");
+    printf("rbc_queue_depth_max %lld\n", (long long)STAT_LOAD(stats->queueDepthMax));
+    printf("# HELP rbc_deadlocks_total Wait-for cycles confirmed between trains.\n# TYPE rbc_deadlocks_total counter\n");
+    printf("rbc_deadlocks_total %llu\n", (unsigned long long)STAT_LOAD(stats->deadlocks));
+    printf("# HELP rbc_segment_decisions_total Requests to enter a segment by decision.\n# TYPE rbc_segment_decisions_total counter\n");
+    for(int i = 0; i < stats->nSegm; i++) {
+        printf("rbc_segment_decisions_total{segment=\"MA%d\",decision=\"granted\"} %llu\n", i + 1, (unsigned long long)STAT_LOAD(stats->segms[i].granted));
+        printf("rbc_segment_decisions_total{segment=\"MA%d\",decision=\"denied\"} %llu\n", i + 1, (unsigned long long)STAT_LOAD(stats->segms[i].denied));
+    }
+    printf("# HELP rbc_stage_duration_seconds Time spent in each stage of a request.\n# TYPE rbc_stage_duration_seconds histogram\n");
+    for(int s = 0; s < STATS_N_STAGES; s++) {
+        const statsHist_t *hist = &stats->stages[s];
+        // Buckets are cumulative in the exposition format
+        uint64_t cumulative = 0;
+        for(int i = 0; i < STATS_N_BUCKETS - 1; i++) {
+            cumulative += STAT_LOAD(hist->buckets[i]);
+            printf("rbc_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stageNames[s], statsBucketBound(i) / 1e9,
+                    (unsigned long long)cumulative);
+        }
+        // The count is read after the buckets, so that +Inf is never below the last bucket
+        const uint64_t count = STAT_LOAD(hist->count);
+        cumulative += STAT_LOAD(hist->buckets[STATS_N_BUCKETS - 1]);
+        printf("rbc_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stageNames[s],
+                (unsigned long long)(count > cumulative ? count : cumulative));
+        printf("rbc_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", stageNames[s], STAT_LOAD(hist->sumNs) / 1e9);
+        printf("rbc_stage_duration_seconds_count{stage=\"%s\"} %llu\n", stageNames[s], (unsigned long long)(count > cumulative ? count : cumulative));
+    }
+    stateSnapshot_t snapshot;
+    if(!takeSnapshot(rbcData, &snapshot)) return;
+    printf("# HELP rbc_state_version Changes of the RBC data since the start.\n# TYPE rbc_state_version counter\n");
+    printf("rbc_state_version %u\n", snapshot.version);
+    printf("# HELP rbc_station_trains Trains in each station.\n# TYPE rbc_station_trains gauge\n");
+    for(int i = 0; i < rbcData->nStations; i++) printf("rbc_station_trains{station=\"S%d\"} %d\n", i + 1, snapshot.stations[i]);
+    printf("# HELP rbc_segment_holder Train holding each segment, 0 when free.\n# TYPE rbc_segment_holder gauge\n");
+    for(int i = 0; i < rbcData->nSegm; i++) printf("rbc_segment_holder{segment=\"MA%d\"} %d\n", i + 1, snapshot.segms[i]);
+    free(snapshot.stations);
+}
+
+int main(int argc, char *argv[]) {
+    bool prometheus = false;
+    int interval = 0, opt;
+    while((opt = getopt(argc, argv, "pi:h")) != -1) {
+        if(opt == 'p') prometheus = true;
+        else if(opt == 'i' && atoi(optarg) > 0) interval = atoi(optarg);
+        else {
+            fprintf(stderr, "Usage: %s [-p] [-i seconds]\n  -p  Prometheus text format\n  -i  print again every interval seconds\n", argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    const rbcStats_t *stats = statsAttach();
+    if(!stats) {
+        fprintf(stderr, "%s: no RBC statistics, is the RBC running?\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    // The RBC data is missing while the RBC waits for the map
+    const rbcData_t *rbcData = rbcDataAttach();
+    while(true) {
+        if(prometheus) printPrometheus(stats, rbcData);
+        else printSummary(stats, rbcData);
+        fflush(stdout);
+        if(interval == 0) break;
+        sleep(interval);
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
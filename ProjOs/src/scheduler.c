@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../include/includeF.h"
+#include "../include/includeL.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeR.h"
+#include "../include/includeT.h"
+#include "../include/includeA.h"
+#include "../include/includeC.h"
+
+// In-process scheduler: every TRENO runs as an agent (a state machine) inside PADRE_TRENI.
+// Runnable agents are kept in one deque per worker thread, a worker pops from the back of its own
+// deque and steals from the front of the others when it runs out of work. Agents travelling between
+// positions wait in a timer heap, agents waiting for a segment are parked on it and resumed when
+// the segment is released.
+
+// TYPEDEFS
+// Runnable agents of a worker, a ring buffer large enough to hold every agent
+typedef struct agentDeque_t {
+    pthread_mutex_t lock;
+    agent_t **items;
+    int head;
+    int count;
+    int capacity;
+} agentDeque_t;
+// Agent sleeping until wakeAt, or parked until wakeAt at most when parkSeq is not 0
+typedef struct timerEntry_t {
+    uint64_t wakeAt;
+    agent_t *agent;
+    uint32_t parkSeq;
+} timerEntry_t;
+// Worker thread, session is its connection to the RBC in ETCS2
+typedef struct worker_t {
+    int id;
+    pthread_t thread;
+    agentDeque_t deque;
+    rbcSession_t *session;
+} worker_t;
+// Agents parked on a segment
+typedef struct parkList_t {
+    agent_t **agents;
+    int count;
+    int capacity;
+} parkList_t;
+typedef struct sched_t {
+    int etcs;
+    int nAgents;
+    int nWorkers;
+    worker_t *workers;
+    atomic_int live;            // agents that have not reached their destination
+    atomic_bool stalled;        // virtual time run with no event left to process
+    atomic_int ready;           // agents waiting in the deques
+    pthread_mutex_t lock;       // protects timers and nIdle
+    pthread_cond_t wakeup;
+    int nIdle;
+    timerEntry_t *timers;       // min-heap on wakeAt
+    int nTimers;
+    int timerCapacity;
+    bool parkTimeout;           // parked agents ask again after SEGM_WAIT_TIMEOUT_MS
+    pthread_mutex_t parkLock;   // protects parked
+    parkList_t *parked;         // one list per segment
+} sched_t;
+
+static sched_t sched;
+// Worker running on the current thread
+static __thread worker_t *currWorker = NULL;
+
+// Scheduler clock in nanoseconds, virtual in virtual time runs
+static uint64_t nowNs() {
+    return clockNowNs();
+}
+
+static void dequeInit(agentDeque_t *deque, const int capacity) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->items = (agent_t **)malloc(capacity * sizeof(agent_t *));
+    if(!deque->items) throwError("Failed to allocate agent deque");
+    deque->head = deque->count = 0;
+    deque->capacity = capacity;
+}
+
+static void dequePush(agentDeque_t *deque, agent_t *agent) {
+    pthread_mutex_lock(&deque->lock);
+    deque->items[(deque->head + deque->count) % deque->capacity] = agent;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// The owner takes the most recently pushed agent
+static agent_t *dequePop(agentDeque_t *deque) {
+    agent_t *agent = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0) {
+        deque->count--;
+        agent = deque->items[(deque->head + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return agent;
+}
+
+// Thieves take the oldest agent
+static agent_t *dequeSteal(agentDeque_t *deque) {
+    agent_t *agent = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0) {
+        agent = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return agent;
+}
+
+// Heap operations, called with sched.lock held
+static void timerPush(const uint64_t wakeAt, agent_t *agent, const uint32_t parkSeq) {
+    // A parked agent may leave a park timeout behind besides its own timer
+    if(sched.nTimers == sched.timerCapacity) {
+        sched.timerCapacity *= 2;
+        sched.timers = (timerEntry_t *)realloc(sched.timers, sched.timerCapacity * sizeof(timerEntry_t));
+        if(!sched.timers) throwError("Failed to allocate scheduler timers");
+    }
+    int i = sched.nTimers++;
+    while(i > 0 && sched.timers[(i - 1) / 2].wakeAt > wakeAt) {
+        sched.timers[i] = sched.timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sched.timers[i] = (timerEntry_t){ .wakeAt = wakeAt, .agent = agent, .parkSeq = parkSeq };
+}
+
+static timerEntry_t timerPop() {
+    const timerEntry_t first = sched.timers[0];
+    const timerEntry_t last = sched.timers[--sched.nTimers];
+    int i = 0;
+    while(true) {
+        int child = 2 * i + 1;
+        if(child >= sched.nTimers) break;
+        if(child + 1 < sched.nTimers && sched.timers[child + 1].wakeAt < sched.timers[child].wakeAt) child++;
+        if(sched.timers[child].wakeAt >= last.wakeAt) break;
+        sched.timers[i] = sched.timers[child];
+        i = child;
+    }
+    sched.timers[i] = last;
+    return first;
+}
+
+// Wakes one idle worker, if any
+static void schedNotify() {
+    pthread_mutex_lock(&sched.lock);
+    if(sched.nIdle > 0) pthread_cond_signal(&sched.wakeup);
+    pthread_mutex_unlock(&sched.lock);
+}
+
+// Makes an agent runnable on the current worker, or on the first one when called outside the pool
+static void schedReady(agent_t *agent) {
+    worker_t *worker = currWorker ? currWorker : &sched.workers[0];
+    atomic_fetch_add(&sched.ready, 1);
+    dequePush(&worker->deque, agent);
+    schedNotify();
+}
+
+// Makes an agent runnable again at wakeAt, or ends its park parkSeq at wakeAt
+static void schedTimer(agent_t *agent, const uint64_t wakeAt, const uint32_t parkSeq) {
+    pthread_mutex_lock(&sched.lock);
+    timerPush(wakeAt, agent, parkSeq);
+    // The earliest deadline may have changed
+    if(sched.nIdle > 0) pthread_cond_signal(&sched.wakeup);
+    pthread_mutex_unlock(&sched.lock);
+}
+
+static void schedSleep(agent_t *agent, const uint64_t wakeAt) {
+    schedTimer(agent, wakeAt, 0);
+}
+
+// Release hook: resumes the agents parked on the released segment.
+// An agent whose park timed out is left in the list until then, and skipped.
+static void schedSegmReleased(const int segmNum) {
+    pthread_mutex_lock(&sched.parkLock);
+    parkList_t *list = &sched.parked[segmNum - 1];
+    while(list->count > 0) {
+        agent_t *agent = list->agents[--list->count];
+        if(!agent->parked) continue;
+        agent->parked = false;
+        schedReady(agent);
+    }
+    pthread_mutex_unlock(&sched.parkLock);
+}
+
+// Ends the park parkSeq of an agent when its timeout expires.
+// Returns: false if the agent was resumed by a release in the meantime
+static bool agentUnpark(agent_t *agent, const uint32_t parkSeq) {
+    pthread_mutex_lock(&sched.parkLock);
+    const bool parked = agent->parked && agent->parkSeq == parkSeq;
+    if(parked) agent->parked = false;
+    pthread_mutex_unlock(&sched.parkLock);
+    return parked;
+}
+
+// Parks an agent that could not advance. If its next position is a segment still occupied, the
+// agent is resumed by schedSegmReleased; otherwise it retries after a short pause.
+// The occupancy check and the insertion happen under parkLock, so a release in between is not missed.
+// With parkTimeout the agent also asks again after SEGM_WAIT_TIMEOUT_MS, as segmWait lets a TRENO process do:
+// the RBC only learns from new requests that trains wait for each other.
+static void agentPark(agent_t *agent) {
+    const int32_t nextNode = agent->route.nodes[agent->step + 1];
+    if(!NODE_IS_STATION(nextNode)) {
+        const int segmNum = NODE_NUM(nextNode);
+        pthread_mutex_lock(&sched.parkLock);
+        if(!isSegmentFree(segmNum)) {
+            parkList_t *list = &sched.parked[segmNum - 1];
+            if(list->count == list->capacity) {
+                list->capacity = list->capacity ? 2 * list->capacity : 4;
+                list->agents = (agent_t **)realloc(list->agents, list->capacity * sizeof(agent_t *));
+                if(!list->agents) throwError("Failed to park agent");
+            }
+            list->agents[list->count++] = agent;
+            agent->parked = true;
+            const uint32_t parkSeq = ++agent->parkSeq ? agent->parkSeq : ++agent->parkSeq;
+            pthread_mutex_unlock(&sched.parkLock);
+            if(sched.parkTimeout) schedTimer(agent, nowNs() + SEGM_WAIT_TIMEOUT_MS * NS_PER_MS, parkSeq);
+            return;
+        }
+        pthread_mutex_unlock(&sched.parkLock);
+    }
+    schedSleep(agent, nowNs() + SEGM_RETRY_MS * NS_PER_MS);
+}
+
+// Connection to the RBC of the current worker, opened on first use. Worker sessions carry the
+// requests of many trains, so they are not tied to a train number.
+static rbcSession_t *workerSession(worker_t *worker) {
+    if(sched.etcs != 2) return NULL;
+    if(!worker->session) worker->session = rbcSessionOpen(0);
+    return worker->session;
+}
+
+// agentRun advances an agent through the same steps as the TRENO process main loop, until the
+// agent has to wait: for its travel time, for a segment, or because it reached its destination.
+static void agentRun(agent_t *agent) {
+    int32_t currNode, nextNode;
+    char currPos[NODE_NAME_SIZE], nextPos[NODE_NAME_SIZE];
+    while(true) {
+        switch(agent->state) {
+            case AGENT_START:
+                printf("TRENO %d Began execution as agent.\n", agent->trainNum);
+                logReset(agent->trainNum);
+                // Compile the itinerary once, the agent only works on node identifiers afterwards
+                agent->route = routeCompile(getIt(agent->trainNum));
+                // If no itinerary is received, terminate execution
+                if(agent->route.nNodes == 0) {
+                    logUpdate(agent->trainNum, NODE_NONE, NODE_NONE);
+                    agent->state = AGENT_DONE;
+                    break;
+                }
+                agent->step = 0;
+                agent->authEnd = 0;
+                agent->state = AGENT_NEXT;
+                break;
+            case AGENT_NEXT:
+                if(agent->step + 1 == agent->route.nNodes) {
+                    // Update the log file for the last iteration
+                    logUpdate(agent->trainNum, agent->route.nodes[agent->step], NODE_NONE);
+                    agent->state = AGENT_DONE;
+                    break;
+                }
+                logUpdate(agent->trainNum, agent->route.nodes[agent->step], agent->route.nodes[agent->step + 1]);
+                // Travel to the end of the current position
+                agent->state = AGENT_ADVANCE;
+                schedSleep(agent, nowNs() + TRAVEL_TIME * NS_PER_SEC);
+                return;
+            case AGENT_ADVANCE:
+                currNode = agent->route.nodes[agent->step];
+                nextNode = agent->route.nodes[agent->step + 1];
+                nodeFormat(currNode, currPos, sizeof(currPos));
+                nodeFormat(nextNode, nextPos, sizeof(nextPos));
+                printf("TRENO %d Current position: %s, requesting permission to proceed to next position: %s.\n", agent->trainNum, currPos, nextPos);
+                switch(moveForward(workerSession(currWorker), agent->trainNum, &agent->route, agent->step, &agent->authEnd)) {
+                    case MOVE_WAIT:
+                        agentPark(agent);
+                        return;
+                    case MOVE_WITHDRAWN:
+                        printf("TRENO %d Withdrawn by RBC at %s to break a deadlock.\n", agent->trainNum, currPos);
+                        logUpdate(agent->trainNum, currNode, NODE_NONE);
+                        agent->state = AGENT_DONE;
+                        break;
+                    case MOVE_DONE:
+                        agent->step++;
+                        agent->state = AGENT_NEXT;
+                        break;
+                }
+                break;
+            case AGENT_DONE:
+                printf("TRENO %d Execution terminated.\n", agent->trainNum);
+                routeFree(&agent->route);
+                // The last agent wakes every worker so that the pool can stop
+                if(atomic_fetch_sub(&sched.live, 1) == 1) {
+                    pthread_mutex_lock(&sched.lock);
+                    pthread_cond_broadcast(&sched.wakeup);
+                    pthread_mutex_unlock(&sched.lock);
+                }
+                return;
+        }
+    }
+}
+
+// Finds the next agent to run: own deque first, then the other workers' deques, then expired timers
+static agent_t *workerFind(worker_t *worker) {
+    agent_t *agent = dequePop(&worker->deque);
+    for(int i = 1; !agent && i < sched.nWorkers; i++) {
+        agent = dequeSteal(&sched.workers[(worker->id + i) % sched.nWorkers].deque);
+    }
+    if(agent) {
+        atomic_fetch_sub(&sched.ready, 1);
+        return agent;
+    }
+    timerEntry_t timer = { .agent = NULL, .parkSeq = 0 };
+    pthread_mutex_lock(&sched.lock);
+    if(sched.nTimers > 0 && sched.timers[0].wakeAt <= nowNs()) timer = timerPop();
+    pthread_mutex_unlock(&sched.lock);
+    // parkLock is taken after sched.lock is released, releases take them in the other order
+    if(timer.parkSeq && !agentUnpark(timer.agent, timer.parkSeq)) return NULL;
+    return timer.agent;
+}
+
+// Sleeps until the earliest timer expires or an agent becomes runnable.
+// In virtual time nothing can happen before the earliest timer, so the clock jumps straight to it;
+// if there is no timer left every remaining agent waits for a segment that will never be released.
+static void workerIdle() {
+    pthread_mutex_lock(&sched.lock);
+    if(atomic_load(&sched.ready) == 0 && atomic_load(&sched.live) > 0 && clockIsVirtual()) {
+        if(sched.nTimers > 0) clockAdvanceTo(sched.timers[0].wakeAt);
+        else {
+            printf("PADRE_TRENI Simulation stalled: %d TRENO waiting for each other.\n", atomic_load(&sched.live));
+            atomic_store(&sched.stalled, true);
+            pthread_cond_broadcast(&sched.wakeup);
+        }
+    }
+    else if(atomic_load(&sched.ready) == 0 && atomic_load(&sched.live) > 0) {
+        const uint64_t now = nowNs();
+        uint64_t deadline = now + SCHED_IDLE_MS * NS_PER_MS;
+        if(sched.nTimers > 0 && sched.timers[0].wakeAt < deadline) deadline = sched.timers[0].wakeAt;
+        if(deadline > now) {
+            const struct timespec ts = { .tv_sec = deadline / NS_PER_SEC, .tv_nsec = deadline % NS_PER_SEC };
+            sched.nIdle++;
+            pthread_cond_timedwait(&sched.wakeup, &sched.lock, &ts);
+            sched.nIdle--;
+        }
+    }
+    pthread_mutex_unlock(&sched.lock);
+}
+
+static void *workerMain(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    currWorker = worker;
+    while(atomic_load(&sched.live) > 0 && !atomic_load(&sched.stalled)) {
+        agent_t *agent = workerFind(worker);
+        if(agent) agentRun(agent);
+        else workerIdle();
+    }
+    if(worker->session) rbcSessionClose(worker->session);
+    return NULL;
+}
+
+// schedRun hosts nTrains TRENO as agents on a pool of worker threads sized to the available cores,
+// and returns when every train has reached its destination.
+// Parameters:
+//   - nTrains: the number of trains, numbered from 1
+//   - etcs: the ETCS level, in ETCS2 each worker opens one session to the RBC
+void schedRun(const int nTrains, const int etcs) {
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nCores < 1) nCores = 1;
+    sched.etcs = etcs;
+    // With the detect and off policies the RBC breaks no deadlock: parked agents wait for a release, and a
+    // virtual time run left deadlocked stalls instead of retrying forever
+    const char *policy = getenv(DEADLOCK_POLICY_ENV);
+    sched.parkTimeout = etcs == 2 && !(policy && (!strcmp(policy, "detect") || !strcmp(policy, "off")));
+    sched.nAgents = nTrains;
+    // Virtual time runs use a single worker, so that events are processed in order and runs are repeatable
+    if(clockIsVirtual()) nCores = 1;
+    sched.nWorkers = nCores < nTrains ? nCores : nTrains;
+    if(sched.nWorkers > SCHED_MAX_WORKERS) sched.nWorkers = SCHED_MAX_WORKERS;
+    atomic_init(&sched.live, nTrains);
+    atomic_init(&sched.stalled, false);
+    atomic_init(&sched.ready, 0);
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_mutex_init(&sched.parkLock, NULL);
+    // Timed waits use the same clock as the timers
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched.wakeup, &condAttr);
+    sched.nIdle = sched.nTimers = 0;
+    sched.timerCapacity = nTrains;
+    sched.timers = (timerEntry_t *)malloc(sched.timerCapacity * sizeof(timerEntry_t));
+    sched.parked = (parkList_t *)calloc(occupancyAttach()->nSegm, sizeof(parkList_t));
+    sched.workers = (worker_t *)calloc(sched.nWorkers, sizeof(worker_t));
+    agent_t *agents = (agent_t *)calloc(nTrains, sizeof(agent_t));
+    if(!sched.timers || !sched.parked || !sched.workers || !agents) throwError("Failed to allocate scheduler");
+    for(int i = 0; i < sched.nWorkers; i++) {
+        sched.workers[i].id = i;
+        dequeInit(&sched.workers[i].deque, nTrains);
+    }
+    occupancySetReleaseHook(schedSegmReleased);
+    // Agents are spread over the workers before they start
+    for(int i = 0; i < nTrains; i++) {
+        agents[i].trainNum = i + 1;
+        agents[i].state = AGENT_START;
+        dequePush(&sched.workers[i % sched.nWorkers].deque, &agents[i]);
+        atomic_fetch_add(&sched.ready, 1);
+    }
+    printf("PADRE_TRENI hosting %d TRENO on %d workers.\n", nTrains, sched.nWorkers);
+    for(int i = 0; i < sched.nWorkers; i++) {
+        if(pthread_create(&sched.workers[i].thread, NULL, workerMain, &sched.workers[i]) != 0) {
+            throwError("Failed to create scheduler worker");
+        }
+    }
+    for(int i = 0; i < sched.nWorkers; i++) pthread_join(sched.workers[i].thread, NULL);
+    occupancySetReleaseHook(NULL);
+    // Free the scheduler
+    for(int i = 0; i < sched.nWorkers; i++) free(sched.workers[i].deque.items);
+    for(int i = 0; i < occupancyAttach()->nSegm; i++) free(sched.parked[i].agents);
+    free(sched.workers);
+    free(sched.parked);
+    free(sched.timers);
+    free(agents);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -5,46 +6,230 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include "../include/includeF.h"
+#include "../include/includeO.h"
+#include "../include/includeK.h"
+#include "../include/includeR.h"
+#include "../include/includeS.h"
 
+// Process supervision: a process waits for its children and for the signals asking it to stop in one event loop,
+// without signal handlers. The signals are blocked and read from a signalfd between two events, and each child
+// is watched through a pidfd that becomes readable as soon as it exits, so it is reaped at once.
+// A stop signal (SIGUSR2, SIGTERM, SIGINT) stops the children one at a time, the last created first, each one
+// reaped before the next is asked: PADRE_TRENI stops its trains and the RBC before REGISTRO is stopped, and no
+// process exits before its children. Where pidfd_open is missing the children are reaped on SIGCHLD instead.
 
+// TYPEDEFS
+typedef struct superviseChild_t {
+    pid_t pid;
+    int pidfd;              // -1 when the child is reaped on SIGCHLD
+    bool running;
+    const char *path;
+} superviseChild_t;
 
-// SIGNAL HANDLERS
+static sigset_t savedMask;
+static int signalFd = -1, superviseFd = -1;
+static superviseChild_t *children = NULL;
+static int nChildren = 0, nRunning = 0, childrenCapacity = 0;
 
-// Called each time a train arrives at its destination. When all TRENO processes terminate, RBC terminates.
-void signalHandler(int sign) {
-    printf("TRENO process terminated.\n");
-        // Repeatedly call waitpid until it returns a value less than or equal to 0
-        if (waitpid(0, NULL, 0) <= 0) {
-            // When in ETC 2 mode, use a SIGUSR signal to terminate RBC before terminating
-            if (rbcPid != 0) {
-                printf("Sending SIGUSR2 to RBC, pid: %d\n", rbcPid);
-                kill(rbcPid, SIGUSR2);
+// superviseInit blocks the signals read by the supervision, before the process creates any child or thread.
+// Returns: the signalfd they are read from, for the event loops of the RBC
+int superviseInit() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if(sigprocmask(SIG_BLOCK, &mask, &savedMask) == -1) throwError("Failed to block signals");
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signalFd == -1) throwError("Failed to create signal descriptor");
+    superviseFd = epoll_create1(EPOLL_CLOEXEC);
+    if(superviseFd == -1) throwError("Failed to create epoll instance");
+    // The signal descriptor is the only event without a child
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = 0 };
+    if(epoll_ctl(superviseFd, EPOLL_CTL_ADD, signalFd, &event) == -1) throwError("Failed to watch signal descriptor");
+    return signalFd;
+}
+
+// superviseChild gives a child process the signals of its parent back, it supervises nothing
+void superviseChild() {
+    sigprocmask(SIG_SETMASK, &savedMask, NULL);
+    if(signalFd != -1) close(signalFd);
+    if(superviseFd != -1) close(superviseFd);
+    signalFd = superviseFd = -1;
+    nChildren = nRunning = 0;
+}
+
+// superviseSpawn executes path in a child process watched by superviseRun
+// Returns: the pid of the child
+pid_t superviseSpawn(const char *path, char *const argv[]) {
+    const pid_t pid = fork();
+    if(pid == -1) throwError("Fork failed to create child process");
+    if(pid == 0) {
+        superviseChild();
+        execv(path, argv);
+        throwError("Execv failed to execute child process");
+    }
+    if(nChildren == childrenCapacity) {
+        childrenCapacity = childrenCapacity ? childrenCapacity * 2 : 8;
+        children = (superviseChild_t *)realloc(children, childrenCapacity * sizeof(superviseChild_t));
+        if(!children) throwError("Failed to allocate child processes");
+    }
+    superviseChild_t *child = &children[nChildren++];
+    child->pid = pid;
+    child->running = true;
+    child->path = path;
+    // A child that already exited is not reaped yet, its pidfd is readable at once
+    child->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if(child->pidfd != -1) {
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = nChildren };
+        if(epoll_ctl(superviseFd, EPOLL_CTL_ADD, child->pidfd, &event) == -1) throwError("Failed to watch child process");
+    }
+    else if(errno != ENOSYS) throwError("Failed to open child process");
+    nRunning++;
+    return pid;
+}
+
+// Reaps a child if it exited
+// Returns: -1 while it runs, 0 if it succeeded, 1 if it failed
+static int childReap(superviseChild_t *child) {
+    int status;
+    if(!child->running || waitpid(child->pid, &status, WNOHANG) <= 0) return -1;
+    // Closing the pidfd also removes it from the epoll set
+    if(child->pidfd != -1) close(child->pidfd);
+    child->running = false;
+    nRunning--;
+    if(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) return 0;
+    if(WIFSIGNALED(status)) printf("%s (pid %d) killed by signal %d.\n", child->path, child->pid, WTERMSIG(status));
+    else printf("%s (pid %d) exited with status %d.\n", child->path, child->pid, WEXITSTATUS(status));
+    return 1;
+}
+
+// superviseSignal reads the signals received since the last call. A supervisor reaps on SIGCHLD the children it
+// has no pidfd for; any other process, the RBC and its session children, reaps every child that exited.
+// Returns: true if the process was asked to stop
+bool superviseSignal() {
+    struct signalfd_siginfo info;
+    bool stop = false;
+    while(read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if(info.ssi_signo != SIGCHLD) stop = true;
+        else if(nChildren == 0) while(waitpid(-1, NULL, WNOHANG) > 0);
+    }
+    return stop;
+}
+
+// Sends sig to the last child still running, to stop it before deadline
+static void stopNext(const int sig, struct timespec *deadline) {
+    for(int i = nChildren - 1; i >= 0; i--) {
+        if(!children[i].running) continue;
+        kill(children[i].pid, sig);
+        clock_gettime(CLOCK_MONOTONIC, deadline);
+        deadline->tv_sec += SUPERVISE_STOP_MS / 1000;
+        deadline->tv_nsec += (SUPERVISE_STOP_MS % 1000) * 1000000L;
+        return;
+    }
+}
+
+// Milliseconds left before a deadline, 0 once it passed
+static int msLeft(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
+
+// superviseRun waits until every child created by superviseSpawn has exited, reaping each one as it exits.
+// A stop signal stops the children still running, the last created first. With stopOnFailure the failure of a
+// child stops the others as well: they would wait forever for what it did not do.
+// Returns: the number of children that failed
+int superviseRun(const bool stopOnFailure) {
+    struct epoll_event events[RBC_MAX_EVENTS];
+    struct timespec deadline;
+    bool stopping = false;
+    int failed = 0;
+    while(nRunning > 0) {
+        const int nEvents = epoll_wait(superviseFd, events, RBC_MAX_EVENTS, stopping ? msLeft(&deadline) : -1);
+        if(nEvents == -1) {
+            if(errno == EINTR) continue;
+            throwError("Error waiting for child processes");
+        }
+        // The child asked to stop did not in time
+        if(nEvents == 0) {
+            stopNext(SIGKILL, &deadline);
+            continue;
+        }
+        int reaped = 0;
+        for(int i = 0; i < nEvents; i++) {
+            const uint32_t index = events[i].data.u32;
+            if(index == 0 && superviseSignal() && !stopping) {
+                printf("Stop requested, stopping child processes.\n");
+                stopping = true;
+                stopNext(SIGTERM, &deadline);
             }
-            printf("TRENO processes terminated.\n");
-            printf("REGISTRO, PADRE_TRENI: end of execution\n");
-            // Delete the segment files
-            char filename[32];
-            for (int i = 1; i <= N_SEGM; i++) {
-                sprintf(filename, SEGM_FORMAT, i);
-                unlink(filename);
+            // The pidfd of a child is readable, or SIGCHLD came for the children without one
+            for(int c = 0; c < nChildren; c++) {
+                if(index == 0 ? children[c].pidfd != -1 : c != (int)index - 1) continue;
+                const int result = childReap(&children[c]);
+                if(result == -1) continue;
+                failed += result;
+                reaped++;
+                if(result == 1 && stopOnFailure && !stopping) {
+                    stopping = true;
+                    stopNext(SIGTERM, &deadline);
+                }
             }
-            exit(EXIT_SUCCESS);
-        } else {
-            // Sleep for 1 second between each call to waitpid to avoid busy waiting
-            sleep(1);
         }
+        // The next child is asked once the previous one is gone
+        if(stopping && reaped > 0) stopNext(SIGTERM, &deadline);
+    }
+    return failed;
 }
 
-// Signal Handler for SIGUSR2
-void signalHandler2(int sign){
-    printf("SIGUSR2 from Padre Treni to RBC, terminating RBC\n");
+// superviseTerminate asks a process that is not a child to stop, through a pidfd so that a reused pid is never
+// signalled, and waits until it exited. It is killed after SUPERVISE_STOP_MS.
+void superviseTerminate(const pid_t pid, const int sig) {
+    const int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if(pidfd == -1) {
+        if(errno == ENOSYS) kill(pid, sig);
+        return;
+    }
+    if(syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0) == 0) {
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+        if(poll(&pfd, 1, SUPERVISE_STOP_MS) == 0) syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+    }
+    close(pidfd);
+}
+
+// rbcRunningPid returns the pid of the RBC started as rbcPid, which differs once the RBC was restarted from its
+// checkpoint (WARM)
+pid_t rbcRunningPid(const pid_t rbcPid) {
+    rbcCkptHeader_t header;
+    const int fd = open(RBC_CKPT_FILE, O_RDONLY);
+    if (fd == -1) return rbcPid;
+    const ssize_t n = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (n != sizeof(header) || header.magic != RBC_CKPT_MAGIC || header.firstPid != rbcPid) return rbcPid;
+    return header.pid;
+}
+
+// rbcShutdown ends the RBC once it was asked to stop (SIGUSR2 from PADRE_TRENI), from its event loop.
+// The session children of the fork server die with it.
+void rbcShutdown() {
+    printf("Stop requested from Padre Treni to RBC, terminating RBC\n");
     // Remove shared memory and servers
     if (shm_unlink(SHM_NAME) == -1) {
         perror("Error removing shared memory\n");
     } else {
         printf("Shared memory %s removed.\n", SHM_NAME);
     }
+    shm_unlink(STATS_SHM_NAME);
+    // The run is over, the next RBC starts from REGISTRO
+    unlink(RBC_CKPT_FILE);
     if (unlink(SERVER_NAME) == -1) {
         perror("Error closing server\n");
     } else {
@@ -53,4 +238,4 @@ void signalHandler2(int sign){
     // Print message and exit
     printf("RBC Execution terminated.\n");
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
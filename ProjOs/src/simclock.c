@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeC.h"
+
+// Clock of the simulation. By default every process runs on the wall clock. In a virtual time run
+// PADRE_TRENI creates a shared virtual clock that only moves when the scheduler jumps to the next
+// event, and the other processes read it so that their logs show simulated timestamps.
+
+static bool virtualTime = false;
+// Shared virtual clock, NULL until created or attached
+static simClock_t *simClock = NULL;
+
+// Maps the virtual clock, creating it when create is true.
+// Returns: the mapped clock, or NULL if it does not exist yet
+static simClock_t *clockMap(const bool create) {
+    if(simClock) return simClock;
+    if(create) shm_unlink(CLOCK_SHM_NAME);
+    const int fd = shm_open(CLOCK_SHM_NAME, create ? O_CREAT | O_RDWR : O_RDWR, 0666);
+    if(fd == -1) {
+        if(create) throwError("Failed to create virtual clock");
+        return NULL;
+    }
+    if(create && ftruncate(fd, sizeof(simClock_t)) == -1) throwError("Failed to size virtual clock");
+    simClock_t *mapped = (simClock_t *)mmap(NULL, sizeof(simClock_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapped == MAP_FAILED) throwError("Failed to map virtual clock");
+    close(fd);
+    if(create) {
+        atomic_init(&mapped->nowNs, 0);
+        mapped->epoch = time(NULL);
+    }
+    simClock = mapped;
+    return simClock;
+}
+
+// clockUseVirtual switches the current process to virtual time.
+// Parameters:
+//   - create: true in PADRE_TRENI, which owns the clock; the other processes attach to it on first use
+void clockUseVirtual(const bool create) {
+    virtualTime = true;
+    if(create) clockMap(true);
+}
+
+bool clockIsVirtual() {
+    return virtualTime;
+}
+
+// Returns the current time in nanoseconds: the simulated time in virtual time runs,
+// the monotonic clock otherwise
+uint64_t clockNowNs() {
+    if(virtualTime) {
+        simClock_t *clock = clockMap(false);
+        return clock ? atomic_load(&clock->nowNs) : 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// clockAdvanceTo moves the virtual clock forward to the time of the next event. It never moves backwards.
+void clockAdvanceTo(const uint64_t ns) {
+    simClock_t *clock = clockMap(false);
+    if(!clock) return;
+    uint_fast64_t now = atomic_load(&clock->nowNs);
+    while(now < ns && !atomic_compare_exchange_weak(&clock->nowNs, &now, ns));
+}
+
+// Returns the wall-clock time used in the logs: the start of the run plus the simulated time
+// in virtual time runs, the current time otherwise
+time_t clockWallTime() {
+    if(virtualTime) {
+        simClock_t *clock = clockMap(false);
+        if(clock) return clock->epoch + (time_t)(atomic_load(&clock->nowNs) / 1000000000ULL);
+    }
+    return time(NULL);
+}
+
+// Returns the offset to add to a clockNowNs() value to get the wall-clock time in nanoseconds since the epoch,
+// used to render the timestamps of the binary event log
+int64_t clockWallOffsetNs() {
+    if(virtualTime) {
+        simClock_t *clock = clockMap(false);
+        return clock ? (int64_t)clock->epoch * 1000000000LL : 0;
+    }
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+}
+
+// clockRetryPause waits before retrying a connection to a process that is not ready yet.
+// Connection set-up is not part of the simulated time, so virtual time runs retry much sooner.
+void clockRetryPause() {
+    usleep((virtualTime ? VIRTUAL_RETRY_PAUSE_MS : RETRY_PAUSE_MS) * 1000);
+}
+
+// clockDestroy removes the virtual clock at the end of the run
+void clockDestroy() {
+    if(simClock) {
+        munmap(simClock, sizeof(simClock_t));
+        simClock = NULL;
+    }
+    shm_unlink(CLOCK_SHM_NAME);
+}
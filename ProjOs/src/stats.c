@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../include/includeF.h"
+#include "../include/includeK.h"
+
+// RBC statistics: counters and latency histograms in a shared memory region next to the RBC data.
+// The region is created by the RBC and inherited by its children in fork mode. Updates are relaxed
+// atomic increments, so that they cost no lock and no system call on the request path.
+// Processes that did not create the region (TRENO, the benchmarks) leave rbcStats NULL and record nothing.
+
+rbcStats_t *rbcStats = NULL;
+
+static size_t statsSize(const int nSegm) {
+    return sizeof(rbcStats_t) + nSegm * sizeof(statsSegm_t);
+}
+
+// statsCreate creates the statistics region of an RBC serving nSegm segments, replacing the one of a previous run
+rbcStats_t *statsCreate(const int nSegm) {
+    shm_unlink(STATS_SHM_NAME);
+    // Readable by everyone, only the RBC writes it
+    const int fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if(fd == -1) throwError("Error opening statistics shared memory");
+    if(ftruncate(fd, statsSize(nSegm)) == -1) throwError("Error sizing statistics shared memory");
+    rbcStats = (rbcStats_t *)mmap(NULL, statsSize(nSegm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(rbcStats == MAP_FAILED) throwError("Error mapping statistics shared memory");
+    close(fd);
+    // ftruncate zeroed the counters
+    rbcStats->nStages = STATS_N_STAGES;
+    rbcStats->nSegm = nSegm;
+    rbcStats->pid = getpid();
+    rbcStats->startTime = time(NULL);
+    rbcStats->version = STATS_VERSION;
+    atomic_thread_fence(memory_order_release);
+    rbcStats->magic = STATS_MAGIC;
+    return rbcStats;
+}
+
+// statsAttach maps the statistics region of the running RBC read-only, for rbcstat.
+// Returns: the region, NULL if no RBC created it
+const rbcStats_t *statsAttach() {
+    const int fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+    if(fd == -1) return NULL;
+    struct stat fs;
+    if(fstat(fd, &fs) == -1) throwError("Error reading statistics shared memory");
+    if((size_t)fs.st_size < sizeof(rbcStats_t)) {
+        close(fd);
+        return NULL;
+    }
+    const rbcStats_t *stats = (const rbcStats_t *)mmap(NULL, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(stats == MAP_FAILED) throwError("Error mapping statistics shared memory");
+    if(stats->magic != STATS_MAGIC || stats->version != STATS_VERSION || stats->nStages != STATS_N_STAGES
+            || statsSize(stats->nSegm) > (size_t)fs.st_size) {
+        errno = EINVAL;
+        throwError("Invalid statistics shared memory");
+    }
+    return stats;
+}
+
+void statsDestroy() {
+    shm_unlink(STATS_SHM_NAME);
+}
+
+// statsStart opens the measure of a stage, closed by statsStage.
+// Returns: the current monotonic time in ns, 0 when statistics are not recorded
+uint64_t statsStart() {
+    if(!rbcStats) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Upper bound in ns of a histogram bucket, 0 for the last one which has none
+uint64_t statsBucketBound(const int bucket) {
+    return bucket < STATS_N_BUCKETS - 1 ? 1ULL << (bucket + STATS_MIN_SHIFT) : 0;
+}
+
+// Histogram bucket of a duration
+static int statsBucket(const uint64_t ns) {
+    if(ns < (1ULL << STATS_MIN_SHIFT)) return 0;
+    const int bucket = 63 - __builtin_clzll(ns) - STATS_MIN_SHIFT + 1;
+    return bucket < STATS_N_BUCKETS ? bucket : STATS_N_BUCKETS - 1;
+}
+
+// statsStage records the time spent in a stage since statsStart returned startNs
+void statsStage(const statsStage_t stage, const uint64_t startNs) {
+    if(!rbcStats) return;
+    const uint64_t ns = statsStart() - startNs;
+    statsHist_t *hist = &rbcStats->stages[stage];
+    atomic_fetch_add_explicit(&hist->buckets[statsBucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sumNs, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+}
+
+// statsDecision counts a reply, and the grant or denial of the segment it names.
+// A reply pushed to a queued request answers a request already counted.
+void statsDecision(const int32_t nextNode, const rbcStatus_t status, const bool pushed) {
+    if(!rbcStats) return;
+    atomic_fetch_add_explicit(pushed ? &rbcStats->pushed : &rbcStats->requests, 1, memory_order_relaxed);
+    if(status < STATS_N_STATUS) atomic_fetch_add_explicit(&rbcStats->status[status], 1, memory_order_relaxed);
+    if(status == RBC_BAD_REQUEST || status == RBC_DENIED_WITHDRAWN || NODE_IS_STATION(nextNode) || NODE_NUM(nextNode) > rbcStats->nSegm) return;
+    statsSegm_t *segm = &rbcStats->segms[NODE_NUM(nextNode) - 1];
+    atomic_fetch_add_explicit(status == RBC_GRANTED ? &segm->granted : &segm->denied, 1, memory_order_relaxed);
+}
+
+// Raises the high-water mark of the queue depth
+static void statsQueueMax(const int64_t depth) {
+    int64_t max = atomic_load_explicit(&rbcStats->queueDepthMax, memory_order_relaxed);
+    while(depth > max && !atomic_compare_exchange_weak_explicit(&rbcStats->queueDepthMax, &max, depth,
+            memory_order_relaxed, memory_order_relaxed));
+}
+
+// statsQueue adds delta to the queue depth: +1 when a request is received, -1 when it is answered
+void statsQueue(const int64_t delta) {
+    if(!rbcStats) return;
+    const int64_t depth = atomic_fetch_add_explicit(&rbcStats->queueDepth, delta, memory_order_relaxed) + delta;
+    statsQueueMax(depth);
+}
+
+// statsQueueSet sets the queue depth, for the event-driven server that knows its ready sessions
+void statsQueueSet(const int64_t depth) {
+    if(!rbcStats) return;
+    atomic_store_explicit(&rbcStats->queueDepth, depth, memory_order_relaxed);
+    statsQueueMax(depth);
+}
+
+// statsDeadlock counts a wait-for cycle confirmed between trains
+void statsDeadlock() {
+    if(!rbcStats) return;
+    atomic_fetch_add_explicit(&rbcStats->deadlocks, 1, memory_order_relaxed);
+}
+
+// statsSession counts a session opened or closed
+void statsSession(const bool opened) {
+    if(!rbcStats) return;
+    if(opened) atomic_fetch_add_explicit(&rbcStats->sessionsAccepted, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&rbcStats->sessionsOpen, opened ? 1 : -1, memory_order_relaxed);
+}
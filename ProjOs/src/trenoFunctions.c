@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "../include/includeF.h"
+#include "../include/includeI.h"
+#include "../include/includeO.h"
+#include "../include/includeP.h"
+#include "../include/includeT.h"
+
+// TRENO movement logic, shared by the TRENO processes and the in-process scheduler of PADRE_TRENI
+
+// Global constants
+const char *noPosition = "--";
+const char *pathSeparator = "-";
+
+// Nodes of the movement authority a train asks the RBC for: RAIL_MA_LENGTH, 1 by default
+int authorityLength() {
+    static int length = 0;
+    if(length == 0) {
+        const char *env = getenv(MA_LENGTH_ENV);
+        length = env && atoi(env) > 0 ? atoi(env) : 1;
+        if(length > RBC_MAX_AUTHORITY) length = RBC_MAX_AUTHORITY;
+    }
+    return length;
+}
+
+// Request from RBC to proceed
+// This function sends a message to RBC with the train's ID, current position, next position and the length of the
+// movement authority it asks for over the train's session
+// It then receives and returns the reply of the RBC: when the request is queued, the decision the RBC pushes later
+// The messages are printed here and not by the protocol layer, which bin/loadgen drives at full speed
+rbcReply_t advanceAppr(rbcSession_t *session, const int trainNum, const int32_t currNode, const int32_t nextNode) {
+    const uint32_t reqId = rbcAuthoritySend(session, trainNum, currNode, nextNode, authorityLength());
+    printf("TRENO %d Request %u (%d -> %d) sent to RBC.\n", trainNum, reqId, currNode, nextNode);
+    rbcReply_t reply = rbcReplyRecv(session, reqId);
+    printf("TRENO %d Authorization status %d received from RBC.\n", trainNum, reply.status);
+    while(reply.status == RBC_QUEUED) {
+        reply = rbcReplyRecv(session, reqId);
+        printf("TRENO %d Authorization status %d received from RBC.\n", trainNum, reply.status);
+    }
+    return reply;
+}
+
+// TRENO advancement from route->nodes[pos] to the next node
+// session is the connection to the RBC in ETCS2, NULL in ETCS1. authEnd is the index in the route of the last
+// node the train is authorized to reach, kept by the caller across moves and starting at 0.
+// Inside its movement authority the train moves without asking the RBC, and reports each segment it leaves.
+// A train withdrawn by the RBC frees its position and must end its run.
+move_t moveForward(rbcSession_t *session, const int trainNum, const route_t *route, const int pos, int *authEnd) {
+    const int32_t currNode = route->nodes[pos], nextNode = route->nodes[pos + 1];
+    // When in ETCS2 and past its authority, TRENO must ask RBC; granting it releases the current position
+    const bool asked = session && pos + 1 > *authEnd;
+    if(asked) {
+        const rbcReply_t reply = advanceAppr(session, trainNum, currNode, nextNode);
+        if(reply.status == RBC_DENIED_WITHDRAWN) {
+            if(!NODE_IS_STATION(currNode)) segmRelease(NODE_NUM(currNode));
+            return MOVE_WITHDRAWN;
+        }
+        if(reply.status != RBC_GRANTED) return MOVE_WAIT;
+        *authEnd = pos + (reply.nGranted > 0 ? reply.nGranted : 1);
+    }
+    // If next position is a segment, check that it is free and occupy it in one atomic step
+    if(!NODE_IS_STATION(nextNode) && !segmClaim(NODE_NUM(nextNode))) return MOVE_WAIT;
+    // Current position liberation
+    if(!NODE_IS_STATION(currNode)) {
+        segmRelease(NODE_NUM(currNode));
+        // The RBC still holds the segments of the authority until the train reports leaving them
+        if(session && !asked) rbcReleaseSend(session, trainNum, currNode);
+    }
+    return MOVE_DONE;
+}
+
+// Waits after a failed attempt to advance.
+// When the next position is a segment held by another TRENO, the train parks on it and is woken up
+// as soon as the segment is released. Otherwise the denial does not depend on a segment being
+// released (e.g. the RBC state is being updated) and the train retries after a short pause.
+void waitForRelease(const int32_t nextNode) {
+    if(!NODE_IS_STATION(nextNode) && segmWait(NODE_NUM(nextNode), SEGM_WAIT_TIMEOUT_MS)) return;
+    usleep(SEGM_RETRY_MS * 1000);
+}
+
+// Itinerary request
+// This function reads the itinerary of the given train in the itinerary table published by REGISTRO,
+// waiting for REGISTRO to publish it. The itinerary is read in place and must not be freed.
+const char* getIt(const int trainNum) {
+    const char *itinerary = itinTableGet(trainNum);
+    printf("TRENO %d Received itinerary %s.\n", trainNum, itinerary);
+    return itinerary;
+}
+
+// Itinerary compilation
+// routeCompile parses the itinerary received from REGISTRO ("S1-MA1-MA2-S6", "--" when there is none)
+// once, so that the movement loop works on node identifiers only.
+// Returns: the compiled route, to be released with routeFree
+route_t routeCompile(const char *itinerary) {
+    route_t route = { NULL, 0 };
+    if(!strcmp(itinerary, noPosition)) return route;
+    // One node per separator, plus one
+    int capacity = 1;
+    for(const char *c = itinerary; *c; c++) if(*c == *pathSeparator) capacity++;
+    route.nodes = (int32_t *)malloc(capacity * sizeof(int32_t));
+    if(!route.nodes) throwError("Failed to allocate route");
+    char *copy = strdup(itinerary);
+    char *cursor = copy, *position;
+    while((position = strsep(&cursor, pathSeparator))) {
+        const int32_t node = nodeParse(position);
+        if(node == NODE_NONE) {
+            errno = EINVAL;
+            throwError("Invalid itinerary");
+        }
+        route.nodes[route.nNodes++] = node;
+    }
+    free(copy);
+    return route;
+}
+
+void routeFree(route_t *route) {
+    free(route->nodes);
+    route->nodes = NULL;
+    route->nNodes = 0;
+}